@@ -0,0 +1,145 @@
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/types.h>
+#include "../include/dht11-decode.h"
+
+// Pulse lengths like the ones the driver measures: ~50 cycles low, ~26 high for a 0, ~70 for a 1
+#define LOW_PULSE 50
+#define SHORT_HIGH_PULSE 26
+#define LONG_HIGH_PULSE 70
+
+struct dht11_pulses
+{
+    u32 low[DHT11_FRAME_BITS];
+    u32 high[DHT11_FRAME_BITS];
+};
+
+// The 40 bits of frame, MSB first, as the sensor sends them
+static void encode_frame(struct dht11_pulses *pulses, u64 frame)
+{
+    for (unsigned int i = 0; i < DHT11_FRAME_BITS; i++)
+    {
+        bool bit = (frame >> (DHT11_FRAME_BITS - 1 - i)) & 1;
+        pulses->low[i] = LOW_PULSE;
+        pulses->high[i] = bit ? LONG_HIGH_PULSE : SHORT_HIGH_PULSE;
+    }
+}
+static u64 make_frame(u8 humidity, u8 humidity_decimal, u8 temperature, u8 temperature_decimal, u8 checksum)
+{
+    return (u64)humidity << 32 | (u64)humidity_decimal << 24 | (u64)temperature << 16 |
+           (u64)temperature_decimal << 8 | checksum;
+}
+
+static void dht11_decode_round_trip_test(struct kunit *test)
+{
+    struct dht11_pulses pulses;
+    u64 frame = make_frame(41, 0, 23, 5, 69);
+    encode_frame(&pulses, frame);
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), frame);
+}
+static void dht11_decode_msb_first_test(struct kunit *test)
+{
+    struct dht11_pulses pulses;
+    encode_frame(&pulses, 0);
+    pulses.high[0] = LONG_HIGH_PULSE;
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), 1ULL << (DHT11_FRAME_BITS - 1));
+    encode_frame(&pulses, 0);
+    pulses.high[DHT11_FRAME_BITS - 1] = LONG_HIGH_PULSE;
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), 1ULL);
+}
+// Only a high pulse strictly longer than the low one is a 1
+static void dht11_decode_threshold_test(struct kunit *test)
+{
+    struct dht11_pulses pulses;
+    for (unsigned int i = 0; i < DHT11_FRAME_BITS; i++)
+    {
+        pulses.low[i] = LOW_PULSE;
+        pulses.high[i] = LOW_PULSE;
+    }
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), 0ULL);
+    for (unsigned int i = 0; i < DHT11_FRAME_BITS; i++)
+        pulses.high[i] = LOW_PULSE + 1;
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), (1ULL << DHT11_FRAME_BITS) - 1);
+    for (unsigned int i = 0; i < DHT11_FRAME_BITS; i++)
+        pulses.high[i] = LOW_PULSE - 1;
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), 0ULL);
+    // The extremes a timed out count can produce
+    for (unsigned int i = 0; i < DHT11_FRAME_BITS; i++)
+    {
+        pulses.low[i] = 0;
+        pulses.high[i] = U32_MAX;
+    }
+    KUNIT_EXPECT_EQ(test, dht11_decode_frame(pulses.low, pulses.high), (1ULL << DHT11_FRAME_BITS) - 1);
+}
+static void dht11_frame_byte_test(struct kunit *test)
+{
+    u64 frame = make_frame(0x11, 0x22, 0x33, 0x44, 0x55);
+    KUNIT_EXPECT_EQ(test, dht11_frame_byte(frame, DHT11_HUMIDITY), 0x11);
+    KUNIT_EXPECT_EQ(test, dht11_frame_byte(frame, DHT11_HUMIDITY_DECIMAL), 0x22);
+    KUNIT_EXPECT_EQ(test, dht11_frame_byte(frame, DHT11_TEMPERATURE), 0x33);
+    KUNIT_EXPECT_EQ(test, dht11_frame_byte(frame, DHT11_TEMPERATURE_DECIMAL), 0x44);
+    KUNIT_EXPECT_EQ(test, dht11_frame_byte(frame, DHT11_CHECKSUM), 0x55);
+}
+// The sum of the four bytes only keeps its low 8 bits, like the sensor's
+static void dht11_frame_checksum_wraps_test(struct kunit *test)
+{
+    u64 frame = make_frame(200, 0, 100, 0, 44);
+    KUNIT_EXPECT_EQ(test, dht11_frame_checksum(frame), 44);
+    KUNIT_EXPECT_TRUE(test, dht11_frame_valid(frame));
+    frame = make_frame(0xFF, 0xFF, 0xFF, 0xFF, 0xFC);
+    KUNIT_EXPECT_EQ(test, dht11_frame_checksum(frame), 0xFC);
+    KUNIT_EXPECT_TRUE(test, dht11_frame_valid(frame));
+    // 256 wraps to exactly 0
+    frame = make_frame(128, 0, 128, 0, 0);
+    KUNIT_EXPECT_EQ(test, dht11_frame_checksum(frame), 0);
+    KUNIT_EXPECT_TRUE(test, dht11_frame_valid(frame));
+}
+static void dht11_frame_valid_test(struct kunit *test)
+{
+    KUNIT_EXPECT_TRUE(test, dht11_frame_valid(make_frame(41, 0, 23, 5, 69)));
+    KUNIT_EXPECT_FALSE(test, dht11_frame_valid(make_frame(41, 0, 23, 5, 70)));
+    // A flipped data bit breaks it too
+    KUNIT_EXPECT_FALSE(test, dht11_frame_valid(make_frame(41, 0, 23, 4, 69)));
+}
+// A line stuck low or high: all zeroes happens to checksum, all ones doesn't (4 * 0xFF is 0xFC)
+static void dht11_frame_all_zero_test(struct kunit *test)
+{
+    struct dht11_pulses pulses;
+    u64 frame;
+    encode_frame(&pulses, 0);
+    frame = dht11_decode_frame(pulses.low, pulses.high);
+    KUNIT_EXPECT_EQ(test, frame, 0ULL);
+    KUNIT_EXPECT_EQ(test, dht11_frame_checksum(frame), 0);
+    KUNIT_EXPECT_TRUE(test, dht11_frame_valid(frame));
+}
+static void dht11_frame_all_one_test(struct kunit *test)
+{
+    struct dht11_pulses pulses;
+    u64 frame;
+    encode_frame(&pulses, (1ULL << DHT11_FRAME_BITS) - 1);
+    frame = dht11_decode_frame(pulses.low, pulses.high);
+    KUNIT_EXPECT_EQ(test, frame, (1ULL << DHT11_FRAME_BITS) - 1);
+    for (unsigned int byte = DHT11_HUMIDITY; byte <= DHT11_CHECKSUM; byte++)
+        KUNIT_EXPECT_EQ(test, dht11_frame_byte(frame, byte), 0xFF);
+    KUNIT_EXPECT_EQ(test, dht11_frame_checksum(frame), 0xFC);
+    KUNIT_EXPECT_FALSE(test, dht11_frame_valid(frame));
+}
+
+static struct kunit_case dht11_decode_test_cases[] = {
+    KUNIT_CASE(dht11_decode_round_trip_test),
+    KUNIT_CASE(dht11_decode_msb_first_test),
+    KUNIT_CASE(dht11_decode_threshold_test),
+    KUNIT_CASE(dht11_frame_byte_test),
+    KUNIT_CASE(dht11_frame_checksum_wraps_test),
+    KUNIT_CASE(dht11_frame_valid_test),
+    KUNIT_CASE(dht11_frame_all_zero_test),
+    KUNIT_CASE(dht11_frame_all_one_test),
+    {},
+};
+static struct kunit_suite dht11_decode_test_suite = {
+    .name = "dht11-decode",
+    .test_cases = dht11_decode_test_cases,
+};
+kunit_test_suite(dht11_decode_test_suite);
+MODULE_AUTHOR("Camila Alvarez<cam.alvarez.i@gmail.com>");
+MODULE_LICENSE("GPL");
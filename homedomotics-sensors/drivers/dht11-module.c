@@ -5,9 +5,17 @@
 #include <linux/gpio/consumer.h>
 #include <linux/device.h>
 #include <linux/of.h>
-#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/atomic.h>
 #include <linux/cdev.h>
 #include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/workqueue.h>
+#include <linux/uaccess.h>
 #include <linux/types.h>
 #include <linux/jiffies.h>
 // non-blocking and cannot sleep
@@ -15,7 +23,14 @@
 #include <linux/smp.h>
 #include <linux/cpufreq.h>
 #include <linux/stat.h>
+#include <linux/timekeeping.h>
 #include "../include/dht11-data.h"
+#include "../include/dht11-decode.h"
+#include "sensor-stats.h"
+#include "sensor-hub.h"
+
+#define CREATE_TRACE_POINTS
+#include "dht11-trace.h"
 
 #define DHT11_DEVICE_NAME "dht11_module"
 #define HIGH_SIGNAL 1
@@ -23,15 +38,42 @@
 #define MIN_INTERVAL 1000
 #define UINT32_MAX 0xFFFFFFFF
 #define TIMEOUT UINT32_MAX
-#define BITS_IN_SIGNAL 40
-#define BITS_PER_VALUE 8
+#define BITS_IN_SIGNAL DHT11_FRAME_BITS
+// Used when cpufreq can't tell us the frequency (e.g. on VMs)
+#define DEFAULT_MAX_CYCLES 1000000
+// Set in capture_jiffies while a capture runs, jiffies never get this high
+#define CAPTURE_RUNNING (1ULL << 63)
+// How long a snapshot sleeps between looks at a capture in progress, a whole one takes ~20ms
+#define CAPTURE_WAIT_US 1000
+
+enum dht11_counters
+{
+    DHT11_READS,
+    DHT11_CAPTURES,
+    DHT11_CACHED,
+    DHT11_TIMEOUTS,
+    DHT11_CHECKSUM_FAILURES,
+    DHT11_FILTER_PASSED,
+    DHT11_FILTER_SUPPRESSED,
+    DHT11_COUNTERS,
+};
+static const char *const dht11_counter_names[] = {"reads", "captures", "cached", "timeouts", "checksum_failures",
+                                                  "filter_passed", "filter_suppressed"};
+enum dht11_histograms
+{
+    DHT11_READ_DURATION,
+    DHT11_IRQS_OFF,
+    DHT11_HISTOGRAMS,
+};
+static const char *const dht11_histogram_names[] = {"read_duration_ns", "irqs_off_ns"};
 // We cannot sleep in the read since reading from the sensor is time sensitive
 // Also, it is a bad idea to sleep with interrupts disabled!
 struct dht11_module_data;
-static ssize_t write_measurements_to_user(struct dht11_module_data *dht11_data, char __user *buf, size_t count);
+static ssize_t write_measurements_to_user(const struct dht11_measurement *measurement, char __user *buf, size_t count);
 static u32 count_cycles_in_pulse(struct dht11_module_data *dht11_data, int value);
 static bool compute_values(struct dht11_module_data *dht11_data, u32 *low_values, u32 *high_values);
-static u8 compute_single_value(u32 *low_values, u32 *high_values, int offset);
+static void publish_measurement(struct dht11_module_data *dht11_data);
+static void run_filters(struct dht11_module_data *dht11_data);
 // we set the mode so that everyone can read from the device
 static char *dht11_class_devnode(struct device *dev, umode_t *mode);
 
@@ -40,67 +82,186 @@ struct dht11_module_data
     unsigned int major;
     struct class *dht11_class;
     struct cdev dht11_cdev;
-    spinlock_t gpio_spinlock;
+    // Only the reader that claimed the capture touches the pin
     struct gpio_desc *gpio;
-    spinlock_t read_jiffies_spinlock;
-    uint64_t last_read_jiffies; // Module can be read once per second
-    spinlock_t data_spinlock;
-    u8 last_read_successful;
-    u8 last_successful_humidity;
-    u8 last_successful_humidity_decimal;
-    u8 last_successful_temperature; // in celsius
-    u8 last_successful_temperature_decimal;
+    // Jiffies of the last capture (the module can be read once per second), with CAPTURE_RUNNING
+    // while one is in progress. Readers claim the capture with a cmpxchg on it
+    atomic64_t capture_jiffies;
+    // Latest measurement, written only by the capture owner and read locklessly by everyone else
+    seqcount_t measurement_seq;
+    struct dht11_measurement measurement; // temperature in celsius
     int max_cycles;
+    struct sensor_stats stats;
+    struct sensor_hub_sensor hub;
+    // Files with a filter, the sampler captures once per interval while there is at least one
+    struct mutex filters_mutex;
+    struct list_head filters;
+    unsigned int filter_count;
+    struct delayed_work sampler;
+};
+
+enum dht11_fields
+{
+    DHT11_FIELD_TEMPERATURE,
+    DHT11_FIELD_HUMIDITY,
+    DHT11_FIELDS,
+};
+// One per open file
+struct dht11_reader
+{
+    struct dht11_module_data *dht11_data;
+    // Everything below is protected by filters_mutex, list links us in dht11_data->filters
+    struct list_head list;
+    bool filtered;
+    struct dht11_filter filter;
+    // Last reported values in hundredths and the sign of the change that reported them
+    bool has_reference;
+    s32 reference[DHT11_FIELDS];
+    s8 direction[DHT11_FIELDS];
+    u64 reported_jiffies;
+    struct dht11_measurement reported;
+    // True while read() hasn't returned reported yet, poll checks it without the mutex
+    bool pending;
+    wait_queue_head_t wait;
 };
 
 static int open_sensors(struct inode *inode, struct file *flip)
 {
-    struct dht11_module_data *dht11_data = container_of(inode->i_cdev, struct dht11_module_data, dht11_cdev);
-    flip->private_data = dht11_data;
+    struct dht11_reader *reader = kzalloc(sizeof(struct dht11_reader), GFP_KERNEL);
+    if (reader == NULL)
+        return -ENOMEM;
+    reader->dht11_data = container_of(inode->i_cdev, struct dht11_module_data, dht11_cdev);
+    INIT_LIST_HEAD(&reader->list);
+    init_waitqueue_head(&reader->wait);
+    flip->private_data = reader;
     return nonseekable_open(inode, flip);
 }
+static void clear_filter(struct dht11_reader *reader)
+{
+    struct dht11_module_data *dht11_data = reader->dht11_data;
+    mutex_lock(&dht11_data->filters_mutex);
+    if (reader->filtered)
+    {
+        list_del_init(&reader->list);
+        reader->filtered = false;
+        memset(&reader->filter, 0, sizeof(struct dht11_filter));
+        WRITE_ONCE(reader->pending, false);
+        // The sampler stops by itself when it sees no filters left
+        dht11_data->filter_count--;
+    }
+    mutex_unlock(&dht11_data->filters_mutex);
+    // A blocked read() goes back to returning the newest measurement
+    wake_up_interruptible(&reader->wait);
+}
+static void set_filter(struct dht11_reader *reader, const struct dht11_filter *filter)
+{
+    struct dht11_module_data *dht11_data = reader->dht11_data;
+    mutex_lock(&dht11_data->filters_mutex);
+    reader->filter = *filter;
+    // Start over, the next valid measurement is always reported
+    reader->has_reference = false;
+    memset(reader->direction, 0, sizeof(reader->direction));
+    reader->reported_jiffies = get_jiffies_64();
+    WRITE_ONCE(reader->pending, false);
+    if (!reader->filtered)
+    {
+        reader->filtered = true;
+        list_add_tail(&reader->list, &dht11_data->filters);
+        if (dht11_data->filter_count++ == 0)
+            queue_delayed_work(system_long_wq, &dht11_data->sampler, 0);
+    }
+    mutex_unlock(&dht11_data->filters_mutex);
+}
 static int close_sensors(struct inode *inode, struct file *flip)
 {
+    struct dht11_reader *reader = flip->private_data;
+    clear_filter(reader);
+    kfree(reader);
     return 0;
 }
-static ssize_t read_sensors(struct file *flip, char __user *buf, size_t count, loff_t *off)
+// Only one reader wins the cmpxchg, the others get the current measurement
+static bool claim_capture(struct dht11_module_data *dht11_data, u64 now)
+{
+    s64 last = atomic64_read(&dht11_data->capture_jiffies);
+    if (last & CAPTURE_RUNNING)
+        return false;
+    // now can be behind last: we may have been preempted after reading jiffies while someone
+    // else claimed and finished a capture
+    if (time_before_eq64(now, (u64)last + msecs_to_jiffies(MIN_INTERVAL)))
+        return false;
+    return atomic64_cmpxchg(&dht11_data->capture_jiffies, last, now | CAPTURE_RUNNING) == last;
+}
+static void release_capture(struct dht11_module_data *dht11_data, u64 now)
+{
+    // Orders the measurement before the next claim can see the capture as finished
+    atomic64_set_release(&dht11_data->capture_jiffies, now);
+}
+static void store_measurement(struct dht11_module_data *dht11_data, const struct dht11_measurement *measurement)
+{
+    // The capture owner is the only writer, it only needs to keep from being preempted
+    preempt_disable();
+    write_seqcount_begin(&dht11_data->measurement_seq);
+    dht11_data->measurement = *measurement;
+    write_seqcount_end(&dht11_data->measurement_seq);
+    preempt_enable();
+}
+static void load_measurement(struct dht11_module_data *dht11_data, struct dht11_measurement *measurement)
+{
+    unsigned int seq;
+    do
+    {
+        seq = read_seqcount_begin(&dht11_data->measurement_seq);
+        *measurement = dht11_data->measurement;
+    } while (read_seqcount_retry(&dht11_data->measurement_seq, seq));
+}
+// A failed capture keeps the last values, but marks them as not successful
+static void invalidate_measurement(struct dht11_module_data *dht11_data)
+{
+    struct dht11_measurement measurement;
+    load_measurement(dht11_data, &measurement);
+    measurement.successful = 0;
+    store_measurement(dht11_data, &measurement);
+}
+// Reads the sensor unless someone did it less than a second ago or is doing it right now, in
+// which case the measurement we have is as new as it gets. Returns true when it read the sensor
+static bool capture_measurement(struct dht11_module_data *dht11_data)
 {
-    struct dht11_module_data *dht11_data;
     unsigned long irq_flags;
     uint64_t current_jiffies;
+    u64 irqs_off_ns;
     u32 low_count[BITS_IN_SIGNAL],
         high_count[BITS_IN_SIGNAL];
-    dht11_data = (struct dht11_module_data *)flip->private_data;
-    // 1. Verify that the last request was over a second ago
+    // 1. Verify that the last request was over a second ago, and that nobody else is capturing
     current_jiffies = get_jiffies_64();
-    if ((current_jiffies - dht11_data->last_read_jiffies) <= (uint64_t)msecs_to_jiffies(MIN_INTERVAL))
+    if (!claim_capture(dht11_data, current_jiffies))
     {
-        goto writebuf;
+        trace_dht11_read_start(false);
+        sensor_stats_inc(&dht11_data->stats, DHT11_CACHED);
+        return false;
     }
-    spin_lock(&dht11_data->read_jiffies_spinlock);
-    dht11_data->last_read_jiffies = current_jiffies;
-    spin_unlock(&dht11_data->read_jiffies_spinlock);
+    trace_dht11_read_start(true);
+    sensor_stats_inc(&dht11_data->stats, DHT11_CAPTURES);
 
-    spin_lock(&dht11_data->data_spinlock);
-    dht11_data->max_cycles = cpufreq_get(smp_processor_id()); // Frequency on KHZ (for 1ms = kHZ*1000/1000)
-    spin_unlock(&dht11_data->data_spinlock);
+    // Frequency on KHZ (for 1ms = kHZ*1000/1000). We can be preempted and migrated here, any CPU's
+    // frequency is as good as ours
+    dht11_data->max_cycles = cpufreq_get(raw_smp_processor_id());
+    if (dht11_data->max_cycles == 0)
+        dht11_data->max_cycles = DEFAULT_MAX_CYCLES;
 
     // 2. Send start signal
-    spin_lock(&dht11_data->gpio_spinlock);
     // 2.1 pin is supposed to be in high, we force that
     gpiod_direction_output(dht11_data->gpio, HIGH_SIGNAL);
-    spin_unlock(&dht11_data->gpio_spinlock);
     mdelay(1);
     // 2.2 set pin to low
     // IMPORTANT NOTE: In this case the controller DOES NOT sit on a slow bus, meaning we do not check if
     // we will sleep (we don't use gpiod_cansleep)
-    spin_lock(&dht11_data->gpio_spinlock);
     gpiod_set_value(dht11_data->gpio, LOW_SIGNAL);
-    spin_unlock(&dht11_data->gpio_spinlock);
     // 2.3 wait for at least 18ms (20ms to make sure)
     mdelay(20);
-    // 3. the time sensitive process starts, we need to disable irqs
-    spin_lock_irqsave(&dht11_data->gpio_spinlock, irq_flags);
+    // 3. the time sensitive process starts, we need to disable irqs. We own the pin already,
+    // so there is no lock to take
+    local_irq_save(irq_flags);
+    irqs_off_ns = ktime_get_ns();
     // 4. pull up and wait for 20-40us
     gpiod_set_value(dht11_data->gpio, HIGH_SIGNAL);
     udelay(40);
@@ -110,17 +271,27 @@ static ssize_t read_sensors(struct file *flip, char __user *buf, size_t count, l
     if (count_cycles_in_pulse(dht11_data, LOW_SIGNAL) == TIMEOUT)
     {
         pr_debug("Timeout while reading low signal from dht11\n");
-        dht11_data->last_read_successful = 0;
-        spin_unlock_irqrestore(&dht11_data->gpio_spinlock, irq_flags);
-        goto writebuf;
+        local_irq_restore(irq_flags);
+        irqs_off_ns = ktime_get_ns() - irqs_off_ns;
+        invalidate_measurement(dht11_data);
+        trace_dht11_irqs_off(irqs_off_ns);
+        trace_dht11_timeout(LOW_SIGNAL);
+        sensor_stats_record(&dht11_data->stats, DHT11_IRQS_OFF, irqs_off_ns);
+        sensor_stats_inc(&dht11_data->stats, DHT11_TIMEOUTS);
+        goto release;
     }
     // 7. expect high pulse for 80us
     if (count_cycles_in_pulse(dht11_data, HIGH_SIGNAL) == TIMEOUT)
     {
         pr_debug("Timeout while reading high signal from dht11\n");
-        dht11_data->last_read_successful = 0;
-        spin_unlock_irqrestore(&dht11_data->gpio_spinlock, irq_flags);
-        goto writebuf;
+        local_irq_restore(irq_flags);
+        irqs_off_ns = ktime_get_ns() - irqs_off_ns;
+        invalidate_measurement(dht11_data);
+        trace_dht11_irqs_off(irqs_off_ns);
+        trace_dht11_timeout(HIGH_SIGNAL);
+        sensor_stats_record(&dht11_data->stats, DHT11_IRQS_OFF, irqs_off_ns);
+        sensor_stats_inc(&dht11_data->stats, DHT11_TIMEOUTS);
+        goto release;
     }
     // 8. Read the data, each bit is represented by one low-high cycle
     for (size_t i = 0; i < BITS_IN_SIGNAL; i++)
@@ -129,26 +300,138 @@ static ssize_t read_sensors(struct file *flip, char __user *buf, size_t count, l
         high_count[i] = count_cycles_in_pulse(dht11_data, HIGH_SIGNAL);
     }
     // 9. We finished the time-sensitive process, we can now re-enable interrupts
-    spin_unlock_irqrestore(&dht11_data->gpio_spinlock, irq_flags);
+    local_irq_restore(irq_flags);
+    irqs_off_ns = ktime_get_ns() - irqs_off_ns;
+    trace_dht11_irqs_off(irqs_off_ns);
+    sensor_stats_record(&dht11_data->stats, DHT11_IRQS_OFF, irqs_off_ns);
     // 10. we compute the values: integral and decimal humity, integral and decimal temperature and checksum
     if (!compute_values(dht11_data, low_count, high_count))
-    {
         pr_info("Invalid data read from DHT11\n");
-        goto writebuf;
-    }
-writebuf:
+release:
     // 11. Move pin to output high
-    spin_lock(&dht11_data->gpio_spinlock);
     gpiod_direction_output(dht11_data->gpio, HIGH_SIGNAL);
-    spin_unlock(&dht11_data->gpio_spinlock);
+    release_capture(dht11_data, current_jiffies);
+    // Cached values were published and filtered when they were captured
+    publish_measurement(dht11_data);
+    run_filters(dht11_data);
+    return true;
+}
+// Snapshots share the once per second limit with readers. A capture in progress is as good as
+// our own, so we wait for it. A measurement from an earlier capture would look like it belongs to
+// this snapshot, so it is returned as not valid
+static bool snapshot_capture(struct sensor_hub_sensor *sensor, s32 *values)
+{
+    struct dht11_module_data *dht11_data = container_of(sensor, struct dht11_module_data, hub);
+    struct dht11_measurement measurement;
+    bool fresh = capture_measurement(dht11_data);
+    if (!fresh && (atomic64_read(&dht11_data->capture_jiffies) & CAPTURE_RUNNING))
+    {
+        // Pairs with release_capture, we see the measurement it stored
+        while (atomic64_read_acquire(&dht11_data->capture_jiffies) & CAPTURE_RUNNING)
+            usleep_range(CAPTURE_WAIT_US, 2 * CAPTURE_WAIT_US);
+        fresh = true;
+    }
+    load_measurement(dht11_data, &measurement);
+    values[0] = dht11_to_hundredths(measurement.temperature, measurement.temperature_decimal);
+    values[1] = dht11_to_hundredths(measurement.humidity, measurement.humidity_decimal);
+    return fresh && measurement.successful;
+}
+static const struct sensor_hub_capture_ops dht11_capture_ops = {
+    .capture = snapshot_capture,
+};
+// Runs while at least one file has a filter, filtered readers never capture themselves
+static void sample_measurement(struct work_struct *work)
+{
+    struct dht11_module_data *dht11_data = container_of(to_delayed_work(work), struct dht11_module_data, sampler);
+    capture_measurement(dht11_data);
+    mutex_lock(&dht11_data->filters_mutex);
+    // Just past the interval, so the next claim doesn't find the measurement still current
+    if (dht11_data->filter_count > 0)
+        queue_delayed_work(system_long_wq, &dht11_data->sampler, msecs_to_jiffies(MIN_INTERVAL) + 1);
+    mutex_unlock(&dht11_data->filters_mutex);
+}
+// Without a filter it returns the newest measurement, with one the last one that passed it,
+// waiting for it if read() already returned it
+static ssize_t read_sensors(struct file *flip, char __user *buf, size_t count, loff_t *off)
+{
+    struct dht11_reader *reader = flip->private_data;
+    struct dht11_module_data *dht11_data = reader->dht11_data;
+    struct dht11_measurement measurement;
+    bool filtered;
+    u64 start_ns;
+    ssize_t ret;
+    start_ns = ktime_get_ns();
+    sensor_stats_inc(&dht11_data->stats, DHT11_READS);
+    mutex_lock(&dht11_data->filters_mutex);
+    while (reader->filtered && !reader->pending)
+    {
+        mutex_unlock(&dht11_data->filters_mutex);
+        if (flip->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(reader->wait, READ_ONCE(reader->pending) || !READ_ONCE(reader->filtered)))
+            return -ERESTARTSYS;
+        mutex_lock(&dht11_data->filters_mutex);
+    }
+    filtered = reader->filtered;
+    if (filtered)
+    {
+        measurement = reader->reported;
+        WRITE_ONCE(reader->pending, false);
+    }
+    mutex_unlock(&dht11_data->filters_mutex);
+    if (!filtered)
+    {
+        capture_measurement(dht11_data);
+        load_measurement(dht11_data, &measurement);
+    }
     // 12. write data to user space
-    return write_measurements_to_user(dht11_data, buf, count) ? -EFAULT : 0;
+    ret = write_measurements_to_user(&measurement, buf, count) ? -EFAULT : 0;
+    start_ns = ktime_get_ns() - start_ns;
+    trace_dht11_read_end(ret, measurement.successful, start_ns);
+    sensor_stats_record(&dht11_data->stats, DHT11_READ_DURATION, start_ns);
+    return ret;
+}
+static __poll_t poll_sensors(struct file *flip, poll_table *wait)
+{
+    struct dht11_reader *reader = flip->private_data;
+    poll_wait(flip, &reader->wait, wait);
+    // Without a filter read() never waits
+    if (!READ_ONCE(reader->filtered) || READ_ONCE(reader->pending))
+        return EPOLLIN | EPOLLRDNORM;
+    return 0;
+}
+static long ioctl_sensors(struct file *flip, unsigned int cmd, unsigned long arg)
+{
+    struct dht11_reader *reader = flip->private_data;
+    struct dht11_filter filter;
+    if (_IOC_TYPE(cmd) != IOCTL_DHT11_MAGIC || _IOC_NR(cmd) > IOCTL_DHT11_MAXCMD)
+        return -ENOTTY;
+    switch (cmd)
+    {
+    case IOCTL_DHT11_SET_FILTER:
+        if (copy_from_user(&filter, (void __user *)arg, sizeof(struct dht11_filter)))
+            return -EFAULT;
+        set_filter(reader, &filter);
+        return 0;
+    case IOCTL_DHT11_GET_FILTER:
+        mutex_lock(&reader->dht11_data->filters_mutex);
+        filter = reader->filter;
+        mutex_unlock(&reader->dht11_data->filters_mutex);
+        return copy_to_user((void __user *)arg, &filter, sizeof(struct dht11_filter)) ? -EFAULT : 0;
+    case IOCTL_DHT11_CLEAR_FILTER:
+        clear_filter(reader);
+        return 0;
+    default:
+        return -ENOTTY;
+    }
 }
 static const struct file_operations dht11_module_fops = {
     .llseek = no_llseek,
     .open = open_sensors,
     .release = close_sensors,
     .read = read_sensors,
+    .poll = poll_sensors,
+    .unlocked_ioctl = ioctl_sensors,
 };
 
 static int dht11_probe(struct platform_device *pdev)
@@ -167,9 +450,10 @@ static int dht11_probe(struct platform_device *pdev)
     }
     // By passing the device the function should be able to access de dt
     dht11_data->gpio = devm_gpiod_get(dev, "temperature", GPIOD_OUT_HIGH);
-    spin_lock_init(&dht11_data->gpio_spinlock);
-    spin_lock_init(&dht11_data->read_jiffies_spinlock);
-    spin_lock_init(&dht11_data->data_spinlock);
+    seqcount_init(&dht11_data->measurement_seq);
+    mutex_init(&dht11_data->filters_mutex);
+    INIT_LIST_HEAD(&dht11_data->filters);
+    INIT_DELAYED_WORK(&dht11_data->sampler, sample_measurement);
 
     // we'll register one device with a minor of 0
     error = alloc_chrdev_region(&devt, 0, 1, DHT11_DEVICE_NAME);
@@ -207,13 +491,12 @@ static int dht11_probe(struct platform_device *pdev)
         return -1;
     }
     // To allow the device to be read instantly after it has been initialized
-    dht11_data->last_read_jiffies = get_jiffies_64() - (u64)msecs_to_jiffies(MIN_INTERVAL);
-    // we haven't read anything
-    dht11_data->last_read_successful = 0;
-    dht11_data->last_successful_humidity = 0;
-    dht11_data->last_successful_humidity_decimal = 0;
-    dht11_data->last_successful_temperature = 0;
-    dht11_data->last_successful_temperature_decimal = 0;
+    atomic64_set(&dht11_data->capture_jiffies, get_jiffies_64() - (u64)msecs_to_jiffies(MIN_INTERVAL) - 1);
+    // we haven't read anything, devm_kzalloc left the measurement zeroed
+    sensor_stats_init(&dht11_data->stats, "dht11", dev, dht11_counter_names, DHT11_COUNTERS,
+                      dht11_histogram_names, DHT11_HISTOGRAMS);
+    dht11_data->hub.capture_ops = &dht11_capture_ops;
+    sensor_hub_register(&dht11_data->hub, SENSOR_HUB_DHT11);
     dev_info(dev, "DHT11 module loaded\n");
     platform_set_drvdata(pdev, dht11_data);
     return 0;
@@ -221,31 +504,108 @@ static int dht11_probe(struct platform_device *pdev)
 static int dht11_remove(struct platform_device *pdev)
 {
     struct dht11_module_data *dht11_data = platform_get_drvdata(pdev);
+    // It requeues itself, cancel_delayed_work_sync takes care of that
+    cancel_delayed_work_sync(&dht11_data->sampler);
     unregister_chrdev_region(MKDEV(dht11_data->major, 0), 1);
     device_destroy(dht11_data->dht11_class, MKDEV(dht11_data->major, 0));
     cdev_del(&dht11_data->dht11_cdev);
     class_destroy(dht11_data->dht11_class);
+    sensor_hub_unregister(&dht11_data->hub);
+    sensor_stats_remove(&dht11_data->stats);
 
     dev_info(&pdev->dev, "DHT11 module unloaded\n");
     return 0;
 }
-static ssize_t write_measurements_to_user(struct dht11_module_data *dht11_data, char __user *buf, size_t count)
+static ssize_t write_measurements_to_user(const struct dht11_measurement *measurement, char __user *buf, size_t count)
 {
-    struct dht11_measurement measurement;
     if (count < sizeof(struct dht11_measurement))
     {
         pr_err("Requesting less that necessary. Requires %d vs %zu", sizeof(struct dht11_measurement), count);
         return sizeof(struct dht11_measurement);
     }
-    spin_lock(&dht11_data->data_spinlock);
-    measurement.successful = dht11_data->last_read_successful;
-    measurement.humidity = dht11_data->last_successful_humidity;
-    measurement.humidity_decimal = dht11_data->last_successful_humidity_decimal;
-    measurement.temperature = dht11_data->last_successful_temperature;
-    measurement.temperature_decimal = dht11_data->last_successful_temperature_decimal;
-    spin_unlock(&dht11_data->data_spinlock);
     // return the number of bytes that could not be copied
-    return copy_to_user(buf, &measurement, sizeof(struct dht11_measurement)) ? sizeof(struct dht11_measurement) : 0;
+    return copy_to_user(buf, measurement, sizeof(struct dht11_measurement)) ? sizeof(struct dht11_measurement) : 0;
+}
+static void publish_measurement(struct dht11_module_data *dht11_data)
+{
+    struct dht11_measurement measurement;
+    s32 values[2];
+    u32 flags;
+    load_measurement(dht11_data, &measurement);
+    flags = measurement.successful ? SENSOR_HUB_VALID : 0;
+    values[0] = dht11_to_hundredths(measurement.temperature, measurement.temperature_decimal);
+    values[1] = dht11_to_hundredths(measurement.humidity, measurement.humidity_decimal);
+    sensor_hub_publish(&dht11_data->hub, flags, values, ARRAY_SIZE(values));
+}
+// Turning back needs the hysteresis on top of the delta, the DHT11 often flips between two
+// neighbouring counts and that is not worth a wakeup
+static bool filter_field_passes(const struct dht11_filter *filter, unsigned int delta, s32 reference, s8 direction,
+                                s32 value)
+{
+    s32 change = value - reference;
+    u32 magnitude = abs(change);
+    if (change == 0)
+        return false;
+    if (direction != 0 && (change > 0) != (direction > 0))
+        magnitude = magnitude > filter->hysteresis ? magnitude - filter->hysteresis : 0;
+    if (delta != 0 && magnitude >= delta)
+        return true;
+    // Nothing is relative to 0, only the absolute delta applies there
+    return filter->relative_delta != 0 && reference != 0 &&
+           (u64)magnitude * 1000 >= (u64)filter->relative_delta * abs(reference);
+}
+// Called with filters_mutex held
+static bool filter_passes(struct dht11_reader *reader, const struct dht11_measurement *measurement,
+                          const s32 *values, u64 now)
+{
+    const struct dht11_filter *filter = &reader->filter;
+    unsigned int deltas[DHT11_FIELDS] = {filter->temperature_delta, filter->humidity_delta};
+    bool any_change = !filter->temperature_delta && !filter->humidity_delta && !filter->relative_delta;
+    bool passes = filter->max_silence_ms != 0 &&
+                  time_after_eq64(now, reader->reported_jiffies + msecs_to_jiffies(filter->max_silence_ms));
+    // Failed captures only go through as a heartbeat, that's how readers notice the sensor is gone
+    if (!measurement->successful)
+        return passes;
+    passes |= !reader->has_reference;
+    for (unsigned int i = 0; i < DHT11_FIELDS && !passes; i++)
+        passes = filter_field_passes(filter, any_change ? 1 : deltas[i], reader->reference[i],
+                                     reader->direction[i], values[i]);
+    if (!passes)
+        return false;
+    for (unsigned int i = 0; i < DHT11_FIELDS; i++)
+    {
+        if (reader->has_reference && values[i] != reader->reference[i])
+            reader->direction[i] = values[i] > reader->reference[i] ? 1 : -1;
+        reader->reference[i] = values[i];
+    }
+    reader->has_reference = true;
+    return true;
+}
+// Only the readers whose filter passes are woken up
+static void run_filters(struct dht11_module_data *dht11_data)
+{
+    struct dht11_measurement measurement;
+    struct dht11_reader *reader;
+    s32 values[DHT11_FIELDS];
+    u64 now = get_jiffies_64();
+    load_measurement(dht11_data, &measurement);
+    values[DHT11_FIELD_TEMPERATURE] = dht11_to_hundredths(measurement.temperature, measurement.temperature_decimal);
+    values[DHT11_FIELD_HUMIDITY] = dht11_to_hundredths(measurement.humidity, measurement.humidity_decimal);
+    mutex_lock(&dht11_data->filters_mutex);
+    list_for_each_entry(reader, &dht11_data->filters, list)
+    {
+        if (!filter_passes(reader, &measurement, values, now))
+        {
+            sensor_stats_inc(&dht11_data->stats, DHT11_FILTER_SUPPRESSED);
+            continue;
+        }
+        reader->reported = measurement;
+        reader->reported_jiffies = now;
+        WRITE_ONCE(reader->pending, true);
+        sensor_stats_inc(&dht11_data->stats, DHT11_FILTER_PASSED);
+        wake_up_interruptible(&reader->wait);
+    }
+    mutex_unlock(&dht11_data->filters_mutex);
 }
 // This function is called with irqs disabled
 static u32 count_cycles_in_pulse(struct dht11_module_data *dht11_data, int value)
@@ -263,47 +623,28 @@ static u32 count_cycles_in_pulse(struct dht11_module_data *dht11_data, int value
 }
 static bool compute_values(struct dht11_module_data *dht11_data, u32 *low_values, u32 *high_values)
 {
-    char checksum, humidity, humidity_decimal, temperature, temperature_decimal;
-    humidity = compute_single_value(low_values, high_values, 0);
-    humidity_decimal = compute_single_value(low_values, high_values, BITS_PER_VALUE);
-    temperature = compute_single_value(low_values, high_values, BITS_PER_VALUE * 2);
-    temperature_decimal = compute_single_value(low_values, high_values, BITS_PER_VALUE * 3);
-    checksum = compute_single_value(low_values, high_values, BITS_PER_VALUE * 4);
+    // one pass over the 40 bits, the checksum is compared as a u8 so it wraps like the sensor's
+    u64 frame = dht11_decode_frame(low_values, high_values);
+    struct dht11_measurement measurement;
 
-    if (checksum != (humidity + humidity_decimal + temperature + temperature_decimal))
+    if (!dht11_frame_valid(frame))
     {
-        pr_info("Invalid value obtained from DHT11. Checksum doesn't match: expected %c got %c\n",
-                checksum,
-                humidity + humidity_decimal + temperature + temperature_decimal);
-        spin_lock(&dht11_data->data_spinlock);
-        dht11_data->last_read_successful = 0;
-        spin_unlock(&dht11_data->data_spinlock);
+        pr_info("Invalid value obtained from DHT11. Checksum doesn't match: expected %u got %u\n",
+                dht11_frame_byte(frame, DHT11_CHECKSUM),
+                dht11_frame_checksum(frame));
+        sensor_stats_inc(&dht11_data->stats, DHT11_CHECKSUM_FAILURES);
+        trace_dht11_checksum_failure(dht11_frame_byte(frame, DHT11_CHECKSUM), dht11_frame_checksum(frame));
+        invalidate_measurement(dht11_data);
         return false;
     }
-    spin_lock(&dht11_data->data_spinlock);
-    dht11_data->last_read_successful = 1;
-    dht11_data->last_successful_humidity = humidity;
-    dht11_data->last_successful_humidity_decimal = humidity_decimal;
-    dht11_data->last_successful_temperature = temperature;
-    dht11_data->last_successful_temperature_decimal = temperature_decimal;
-    spin_unlock(&dht11_data->data_spinlock);
+    measurement.successful = 1;
+    measurement.humidity = dht11_frame_byte(frame, DHT11_HUMIDITY);
+    measurement.humidity_decimal = dht11_frame_byte(frame, DHT11_HUMIDITY_DECIMAL);
+    measurement.temperature = dht11_frame_byte(frame, DHT11_TEMPERATURE);
+    measurement.temperature_decimal = dht11_frame_byte(frame, DHT11_TEMPERATURE_DECIMAL);
+    store_measurement(dht11_data, &measurement);
     return true;
 }
-static u8 compute_single_value(u32 *low_values, u32 *high_values, int offset)
-{
-    u8 value = 0;
-    // MSB comes first
-    for (size_t i = 0; i < BITS_PER_VALUE; i++)
-    {
-        // low cycles > high cycles => 0
-        // low cycles < high cycles => 1
-        if (low_values[i + offset] < high_values[i + offset])
-        {
-            value |= 1 << (BITS_PER_VALUE - 1 - i);
-        }
-    }
-    return value;
-}
 static char *dht11_class_devnode(struct device *dev, umode_t *mode)
 {
     if (mode != NULL)
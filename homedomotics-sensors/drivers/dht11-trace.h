@@ -0,0 +1,68 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dht11
+
+#if !defined(_DHT11_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DHT11_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(dht11_read_start,
+            TP_PROTO(bool capture),
+            TP_ARGS(capture),
+            TP_STRUCT__entry(
+                __field(bool, capture)),
+            TP_fast_assign(
+                __entry->capture = capture;),
+            TP_printk("capture=%d", __entry->capture));
+
+TRACE_EVENT(dht11_read_end,
+            TP_PROTO(int ret, u8 successful, u64 duration_ns),
+            TP_ARGS(ret, successful, duration_ns),
+            TP_STRUCT__entry(
+                __field(int, ret)
+                __field(u8, successful)
+                __field(u64, duration_ns)),
+            TP_fast_assign(
+                __entry->ret = ret;
+                __entry->successful = successful;
+                __entry->duration_ns = duration_ns;),
+            TP_printk("ret=%d successful=%u duration_ns=%llu",
+                      __entry->ret, __entry->successful, __entry->duration_ns));
+
+// Time spent with interrupts disabled while sampling the line
+TRACE_EVENT(dht11_irqs_off,
+            TP_PROTO(u64 duration_ns),
+            TP_ARGS(duration_ns),
+            TP_STRUCT__entry(
+                __field(u64, duration_ns)),
+            TP_fast_assign(
+                __entry->duration_ns = duration_ns;),
+            TP_printk("duration_ns=%llu", __entry->duration_ns));
+
+TRACE_EVENT(dht11_timeout,
+            TP_PROTO(int level),
+            TP_ARGS(level),
+            TP_STRUCT__entry(
+                __field(int, level)),
+            TP_fast_assign(
+                __entry->level = level;),
+            TP_printk("waiting_for=%s", __entry->level ? "high" : "low"));
+
+TRACE_EVENT(dht11_checksum_failure,
+            TP_PROTO(u8 expected, u8 computed),
+            TP_ARGS(expected, computed),
+            TP_STRUCT__entry(
+                __field(u8, expected)
+                __field(u8, computed)),
+            TP_fast_assign(
+                __entry->expected = expected;
+                __entry->computed = computed;),
+            TP_printk("expected=0x%02x computed=0x%02x", __entry->expected, __entry->computed));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dht11-trace
+#include <trace/define_trace.h>
@@ -7,30 +7,57 @@
 #include <linux/types.h>
 #include <linux/interrupt.h>
 #include <linux/irqreturn.h>
-#include <linux/spinlock.h>
+#include <linux/atomic.h>
 #include <linux/miscdevice.h>
 #include <linux/fs.h>
 #include <linux/poll.h>
 #include <linux/timekeeping.h>
+#include "sensor-stats.h"
+#include "sensor-hub.h"
+
+#define CREATE_TRACE_POINTS
+#include "ky004-trace.h"
 
 #define DEVICE_NAME "ky004"
 #define ON 1
 #define OFF 0
 #define DEBOUNCE_NANO 200000000
+
+enum ky004_counters
+{
+    KY004_IRQS,
+    KY004_PRESSES,
+    KY004_DEBOUNCE_REJECTS,
+    KY004_WAKEUPS,
+    KY004_COUNTERS,
+};
+static const char *const ky004_counter_names[] = {"irqs", "presses", "debounce_rejects", "wakeups"};
+enum ky004_histograms
+{
+    KY004_WAKEUP_LATENCY,
+    KY004_PRESS_INTERVAL,
+    KY004_HISTOGRAMS,
+};
+static const char *const ky004_histogram_names[] = {"wakeup_latency_ns", "press_interval_ns"};
 static irqreturn_t button_interrupt_handler(int irq, void *dev_id);
 static unsigned int ky004_poll(struct file *flip, poll_table *wait);
 
 static DECLARE_WAIT_QUEUE_HEAD(onq);
 struct ky004_data
 {
-    spinlock_t data_spinlock;
+    // The irq handler is the only writer of on and last_button_press, poll only needs on
     bool on;
+    u64 last_button_press;
+    // Time of the press that turned the LED on, until the first poll() that sees it takes it.
+    // 0 when there is none, so the wakeup latency is measured once per press
+    atomic64_t pending_press;
     struct gpio_desc *button_gpio;
-    spinlock_t led_spinlock;
+    // Only set from the irq handler
     struct gpio_desc *led_gpio;
     int button_irq;
-    spinlock_t time_spinlock;
-    u64 last_button_press;
+    u32 presses;
+    struct sensor_stats stats;
+    struct sensor_hub_sensor hub;
 };
 static struct file_operations ky004_fops = {
     .llseek = no_llseek,
@@ -75,14 +102,18 @@ static int ky004_probe(struct platform_device *device)
     data->led_gpio = led;
     data->button_irq = irq_button;
     data->last_button_press = ktime_get_ns() - DEBOUNCE_NANO;
-    spin_lock_init(&data->data_spinlock);
-    spin_lock_init(&data->led_spinlock);
-    spin_lock_init(&data->time_spinlock);
+    atomic64_set(&data->pending_press, 0);
+    sensor_stats_init(&data->stats, "ky004", &device->dev, ky004_counter_names, KY004_COUNTERS,
+                      ky004_histogram_names, KY004_HISTOGRAMS);
+    // Before the irq, the handler publishes right away
+    sensor_hub_register(&data->hub, SENSOR_HUB_KY004);
     error = devm_request_any_context_irq(&device->dev, irq_button, button_interrupt_handler,
                                          irq_flags, DEVICE_NAME, data);
     if (error)
     {
         dev_err(&device->dev, "irq %d request failed: %d\n", irq_button, error);
+        sensor_hub_unregister(&data->hub);
+        sensor_stats_remove(&data->stats);
         kfree(data);
         return error;
     }
@@ -90,6 +121,10 @@ static int ky004_probe(struct platform_device *device)
     if (error)
     {
         dev_err(&device->dev, "Could not register device\n");
+        // The handler uses data, it has to be gone before data is
+        devm_free_irq(&device->dev, irq_button, data);
+        sensor_hub_unregister(&data->hub);
+        sensor_stats_remove(&data->stats);
         kfree(data);
         return error;
     }
@@ -101,9 +136,13 @@ static int ky004_probe(struct platform_device *device)
 static int ky004_remove(struct platform_device *device)
 {
     struct ky004_data *data = (struct ky004_data *)platform_get_drvdata(device);
+    // Nothing may reach data once it is freed: first the irq handler, then poll()
+    devm_free_irq(&device->dev, data->button_irq, data);
+    misc_deregister(&ky004_device);
     gpiod_set_value(data->led_gpio, OFF);
+    sensor_hub_unregister(&data->hub);
+    sensor_stats_remove(&data->stats);
     kfree(data);
-    misc_deregister(&ky004_device);
     return 0;
 }
 static irqreturn_t button_interrupt_handler(int irq, void *dev_id)
@@ -111,34 +150,57 @@ static irqreturn_t button_interrupt_handler(int irq, void *dev_id)
     struct ky004_data *data;
     bool device_status;
     u64 last_press, now;
+    s32 values[2];
     now = ktime_get_ns();
     data = dev_id;
-    spin_lock(&data->time_spinlock);
+    // We are the only writer, nobody else reads it
     last_press = data->last_button_press;
-    spin_unlock(&data->time_spinlock);
+    sensor_stats_inc(&data->stats, KY004_IRQS);
     if (data->button_irq == irq && (now - last_press) > DEBOUNCE_NANO)
     {
-        spin_lock(&data->data_spinlock);
         device_status = !data->on;
-        data->on = device_status;
-        spin_unlock(&data->data_spinlock);
-        spin_lock(&data->led_spinlock);
-        gpiod_set_value(data->led_gpio, device_status ? ON : OFF);
-        spin_unlock(&data->led_spinlock);
-        spin_lock(&data->time_spinlock);
         data->last_button_press = now;
-        spin_unlock(&data->time_spinlock);
+        // A press that turns the LED off cancels one that nobody woke up for. Set before on is
+        // released, a poll that sees the LED on also sees its press
+        atomic64_set(&data->pending_press, device_status ? now : 0);
+        smp_store_release(&data->on, device_status);
+        gpiod_set_value(data->led_gpio, device_status ? ON : OFF);
+        trace_ky004_press(device_status);
+        values[0] = device_status;
+        values[1] = ++data->presses;
+        // The one lock left on this path: hub_lock, held just long enough to queue the record
+        sensor_hub_publish(&data->hub, SENSOR_HUB_VALID, values, ARRAY_SIZE(values));
+        sensor_stats_inc(&data->stats, KY004_PRESSES);
+        sensor_stats_record(&data->stats, KY004_PRESS_INTERVAL, now - last_press);
         if (device_status)
             wake_up_interruptible(&onq);
     }
+    else if (data->button_irq == irq)
+    {
+        trace_ky004_debounce_reject(now - last_press);
+        sensor_stats_inc(&data->stats, KY004_DEBOUNCE_REJECTS);
+    }
     return IRQ_HANDLED;
 }
 static unsigned int ky004_poll(struct file *flip, poll_table *wait)
 {
     unsigned int reval_mask = 0;
     struct ky004_data *data = dev_get_drvdata(ky004_device.this_device);
-    if (data->on)
+    u64 press;
+    if (smp_load_acquire(&data->on))
+    {
         reval_mask = POLLIN | POLLRDNORM;
+        // Only the first poll after the press reports it, later ones would just measure how
+        // long the LED has been on
+        press = atomic64_xchg(&data->pending_press, 0);
+        if (press != 0)
+        {
+            u64 latency = ktime_get_ns() - press;
+            trace_ky004_wakeup(latency);
+            sensor_stats_inc(&data->stats, KY004_WAKEUPS);
+            sensor_stats_record(&data->stats, KY004_WAKEUP_LATENCY, latency);
+        }
+    }
     else
         poll_wait(flip, &onq, wait);
     return reval_mask;
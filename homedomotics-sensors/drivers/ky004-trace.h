@@ -0,0 +1,44 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ky004
+
+#if !defined(_KY004_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KY004_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ky004_press,
+            TP_PROTO(bool on),
+            TP_ARGS(on),
+            TP_STRUCT__entry(
+                __field(bool, on)),
+            TP_fast_assign(
+                __entry->on = on;),
+            TP_printk("on=%d", __entry->on));
+
+// An interrupt that came in too soon after the last accepted press
+TRACE_EVENT(ky004_debounce_reject,
+            TP_PROTO(u64 since_last_ns),
+            TP_ARGS(since_last_ns),
+            TP_STRUCT__entry(
+                __field(u64, since_last_ns)),
+            TP_fast_assign(
+                __entry->since_last_ns = since_last_ns;),
+            TP_printk("since_last_ns=%llu", __entry->since_last_ns));
+
+// From the accepted interrupt until the first poll() that reports the device readable, once per press
+TRACE_EVENT(ky004_wakeup,
+            TP_PROTO(u64 latency_ns),
+            TP_ARGS(latency_ns),
+            TP_STRUCT__entry(
+                __field(u64, latency_ns)),
+            TP_fast_assign(
+                __entry->latency_ns = latency_ns;),
+            TP_printk("latency_ns=%llu", __entry->latency_ns));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ky004-trace
+#include <trace/define_trace.h>
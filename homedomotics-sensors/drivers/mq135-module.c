@@ -8,14 +8,44 @@
 #include <linux/mutex.h>
 #include <linux/version.h>
 #include <linux/fs.h>
+#include <linux/timekeeping.h>
 #include "../include/mq135-data.h"
+#include "sensor-stats.h"
+#include "sensor-hub.h"
+
+#define CREATE_TRACE_POINTS
+#include "mq135-trace.h"
 
 #define MODNAME "mq135_module"
+
+enum mq135_counters
+{
+    MQ135_READS,
+    MQ135_ERRORS,
+    MQ135_TRANSACTIONS,
+    MQ135_CONVERSION_POLLS,
+    MQ135_COUNTERS,
+};
+static const char *const mq135_counter_names[] = {"reads", "errors", "i2c_transactions", "conversion_polls"};
+enum mq135_histograms
+{
+    MQ135_READ_DURATION,
+    MQ135_CONVERSION_WAIT,
+    MQ135_TRANSACTIONS_PER_SAMPLE,
+    MQ135_POLLS_PER_SAMPLE,
+    MQ135_HISTOGRAMS,
+};
+static const char *const mq135_histogram_names[] = {"read_duration_ns", "conversion_wait_ns",
+                                                    "transactions_per_sample", "polls_per_sample"};
 struct mq135_module_data
 {
     struct miscdevice *dev;
     struct mutex i2c_client_mutex;
+    // One conversion at a time, read() and the hub's snapshots both start them
+    struct mutex sample_mutex;
     struct i2c_client *client;
+    struct sensor_stats stats;
+    struct sensor_hub_sensor hub;
 };
 static ssize_t mq135_read(struct file *flip, char __user *buf, size_t count, loff_t *off);
 static const struct file_operations mq135_fops = {
@@ -95,7 +125,8 @@ static uint16_t conversion_running(struct mq135_module_data *mq135_data, int *er
     *err = 0;
     read_config |= (buffer[0] << 8);
     read_config |= buffer[1];
-    return (read_config & 0x8000) != 0;
+    // OS reads 0 while a conversion is in progress and 1 once the device is idle
+    return (read_config & 0x8000) == 0;
 }
 static int16_t read_converted_data(struct mq135_module_data *mq135_data, int *err)
 {
@@ -126,15 +157,18 @@ static int16_t read_converted_data(struct mq135_module_data *mq135_data, int *er
     *err = 0;
     return read_data;
 }
-static ssize_t mq135_read(struct file *flip, char __user *buf, size_t count, loff_t *off)
+// Runs a single shot conversion and publishes it, for read() and for the hub's snapshots.
+// Returns the number of bus transactions it took
+static unsigned int take_sample(struct mq135_module_data *mq135_data, struct mq135_measurement *data)
 {
-    int quality, ret, err;
-    struct mq135_measurement data = {.air_quality = 0, .read_data = 0};
-    struct miscdevice *dev = flip->private_data;
-    struct mq135_module_data *mq135_data = dev_get_drvdata(dev->this_device);
+    int quality = 0, ret, err;
+    unsigned int polls = 0, transactions = 0;
+    u64 wait_ns;
 
+    mutex_lock(&mq135_data->sample_mutex);
     // 1. Configure the device
     ret = write_config(mq135_data);
+    transactions++;
     if (ret < 0)
     {
         dev_err(&mq135_data->client->adapter->dev, "Error configuring device ADS1115\n");
@@ -142,14 +176,23 @@ static ssize_t mq135_read(struct file *flip, char __user *buf, size_t count, lof
     }
     // 2. Activate alert
     ret = activate_alert_rdy(mq135_data);
+    transactions += 2;
     if (ret < 0)
     {
         dev_err(&mq135_data->client->adapter->dev, "Could not set alrt/rdy ADS1115\n");
         goto finally;
     }
-    // 3. Wait until conversion is ready
-    while (conversion_running(mq135_data, &err))
-        ;
+    // 3. Wait until conversion is ready, each poll is a write and a read on the bus
+    wait_ns = ktime_get_ns();
+    do
+    {
+        polls++;
+    } while (conversion_running(mq135_data, &err));
+    transactions += 2 * polls;
+    wait_ns = ktime_get_ns() - wait_ns;
+    trace_mq135_conversion_wait(polls, wait_ns);
+    sensor_stats_record(&mq135_data->stats, MQ135_CONVERSION_WAIT, wait_ns);
+    sensor_stats_record(&mq135_data->stats, MQ135_POLLS_PER_SAMPLE, polls);
     if (err < 0)
     {
         ret = err;
@@ -158,23 +201,71 @@ static ssize_t mq135_read(struct file *flip, char __user *buf, size_t count, lof
     }
     // 4. Read output
     quality = (int)read_converted_data(mq135_data, &err);
+    transactions += 2;
     if (err)
     {
         ret = err;
         dev_err(&mq135_data->client->adapter->dev, "Could not read quality of air\n");
         goto finally;
     }
-    dev_info(&mq135_data->client->adapter->dev, "Current air quality: %d\n", quality);
 finally:
+    mutex_unlock(&mq135_data->sample_mutex);
+    data->read_data = 0;
+    data->air_quality = 0;
     if (ret > 0)
     {
-        data.read_data = 1;
-        data.air_quality = quality;
+        data->read_data = 1;
+        data->air_quality = quality;
     }
+    else
+    {
+        sensor_stats_inc(&mq135_data->stats, MQ135_ERRORS);
+    }
+    sensor_hub_publish(&mq135_data->hub, data->read_data ? SENSOR_HUB_VALID : 0, &data->air_quality, 1);
+    sensor_stats_add(&mq135_data->stats, MQ135_TRANSACTIONS, transactions);
+    sensor_stats_add(&mq135_data->stats, MQ135_CONVERSION_POLLS, polls);
+    sensor_stats_record(&mq135_data->stats, MQ135_TRANSACTIONS_PER_SAMPLE, transactions);
+    return transactions;
+}
+static ssize_t mq135_read(struct file *flip, char __user *buf, size_t count, loff_t *off)
+{
+    int ret;
+    unsigned int transactions;
+    u64 start_ns;
+    struct mq135_measurement data;
+    struct miscdevice *dev = flip->private_data;
+    struct mq135_module_data *mq135_data = dev_get_drvdata(dev->this_device);
+
+    // Before taking the sample, a buffer it doesn't fit in would only waste the conversion
+    if (count < sizeof(struct mq135_measurement))
+    {
+        pr_err("Requesting less that necessary. Requires %zu vs %zu", sizeof(struct mq135_measurement), count);
+        return -EINVAL;
+    }
+    start_ns = ktime_get_ns();
+    trace_mq135_read_start(mq135_data->client->addr);
+    transactions = take_sample(mq135_data, &data);
     // 5. Send data
-    ret = copy_to_user(buf, &data, sizeof(struct mq135_measurement));
-    return ret < 0 ? -EFAULT : 0;
+    // copy_to_user returns the bytes it couldn't copy, not an error
+    ret = copy_to_user(buf, &data, sizeof(struct mq135_measurement)) ? -EFAULT : 0;
+    start_ns = ktime_get_ns() - start_ns;
+    trace_mq135_read_end(ret, data.air_quality, transactions, start_ns);
+    sensor_stats_inc(&mq135_data->stats, MQ135_READS);
+    sensor_stats_record(&mq135_data->stats, MQ135_READ_DURATION, start_ns);
+    return ret;
 }
+// The conversion starts as soon as the hub asks, unless a read() is converting right now
+static bool snapshot_capture(struct sensor_hub_sensor *sensor, s32 *values)
+{
+    struct mq135_module_data *mq135_data = container_of(sensor, struct mq135_module_data, hub);
+    struct mq135_measurement data;
+    take_sample(mq135_data, &data);
+    values[0] = data.air_quality;
+    return data.read_data;
+}
+static const struct sensor_hub_capture_ops mq135_capture_ops = {
+    .capture = snapshot_capture,
+};
 // Using the old version since we work with a raspberry pi
 static int mq135_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
@@ -195,10 +286,15 @@ static int mq135_probe(struct i2c_client *client, const struct i2c_device_id *id
         return -ENOMEM;
     }
     mutex_init(&mq135_data->i2c_client_mutex);
+    mutex_init(&mq135_data->sample_mutex);
     mq135_data->dev = &mq135_device;
     mq135_data->client = client;
     dev_set_drvdata(mq135_device.this_device, mq135_data);
     i2c_set_clientdata(client, mq135_data);
+    sensor_stats_init(&mq135_data->stats, "mq135", &client->dev, mq135_counter_names, MQ135_COUNTERS,
+                      mq135_histogram_names, MQ135_HISTOGRAMS);
+    mq135_data->hub.capture_ops = &mq135_capture_ops;
+    sensor_hub_register(&mq135_data->hub, SENSOR_HUB_MQ135);
     return 0;
 }
 static void mq135_remove(struct i2c_client *client)
@@ -206,6 +302,8 @@ static void mq135_remove(struct i2c_client *client)
     struct mq135_module_data *mq135_data;
     mq135_data = i2c_get_clientdata(client);
     misc_deregister(mq135_data->dev);
+    sensor_hub_unregister(&mq135_data->hub);
+    sensor_stats_remove(&mq135_data->stats);
     kfree(mq135_data);
 }
 static const struct of_device_id mq135_dts_ids[] = {
@@ -0,0 +1,52 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM mq135
+
+#if !defined(_MQ135_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MQ135_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(mq135_read_start,
+            TP_PROTO(u16 address),
+            TP_ARGS(address),
+            TP_STRUCT__entry(
+                __field(u16, address)),
+            TP_fast_assign(
+                __entry->address = address;),
+            TP_printk("address=0x%02x", __entry->address));
+
+// How long we polled the config register until the OS bit was cleared
+TRACE_EVENT(mq135_conversion_wait,
+            TP_PROTO(unsigned int polls, u64 wait_ns),
+            TP_ARGS(polls, wait_ns),
+            TP_STRUCT__entry(
+                __field(unsigned int, polls)
+                __field(u64, wait_ns)),
+            TP_fast_assign(
+                __entry->polls = polls;
+                __entry->wait_ns = wait_ns;),
+            TP_printk("polls=%u wait_ns=%llu", __entry->polls, __entry->wait_ns));
+
+TRACE_EVENT(mq135_read_end,
+            TP_PROTO(int ret, int air_quality, unsigned int transactions, u64 duration_ns),
+            TP_ARGS(ret, air_quality, transactions, duration_ns),
+            TP_STRUCT__entry(
+                __field(int, ret)
+                __field(int, air_quality)
+                __field(unsigned int, transactions)
+                __field(u64, duration_ns)),
+            TP_fast_assign(
+                __entry->ret = ret;
+                __entry->air_quality = air_quality;
+                __entry->transactions = transactions;
+                __entry->duration_ns = duration_ns;),
+            TP_printk("ret=%d air_quality=%d transactions=%u duration_ns=%llu",
+                      __entry->ret, __entry->air_quality, __entry->transactions, __entry->duration_ns));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mq135-trace
+#include <trace/define_trace.h>
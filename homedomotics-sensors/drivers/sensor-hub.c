@@ -0,0 +1,420 @@
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/kfifo.h>
+#include <linux/wait.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/hrtimer.h>
+#include <net/genetlink.h>
+#include "sensor-hub.h"
+
+#define DEVICE_NAME "sensor_hub"
+// Records queued for every reader, it has to be a power of two
+#define READER_RECORDS 256
+// Records waiting to be multicast, also a power of two
+#define NETLINK_RECORDS 256
+// The DHT11 answers once a second, a bit more leaves room for the capture work starting late.
+// Shorter periods would only get it cached, not valid, values
+#define SNAPSHOT_MIN_PERIOD_MS 1100
+
+static uint snapshot_period_ms;
+module_param(snapshot_period_ms, uint, 0444);
+MODULE_PARM_DESC(snapshot_period_ms, "Take a snapshot of every sensor this often (0 = never, at least 1100)");
+static bool snapshot_on_press;
+module_param(snapshot_on_press, bool, 0644);
+MODULE_PARM_DESC(snapshot_on_press, "Take a snapshot every time the KY-004 button is pressed");
+
+struct sensor_hub_reader
+{
+    struct list_head list;
+    // Publishers put records in holding hub_lock, only read() takes them out
+    DECLARE_KFIFO(fifo, struct sensor_hub_record, READER_RECORDS);
+    struct mutex read_mutex;
+    bool overrun;
+};
+
+// Protects the sensor and reader lists, taken from the KY-004 irq handler too
+static DEFINE_SPINLOCK(hub_lock);
+static LIST_HEAD(hub_sensors);
+static LIST_HEAD(hub_readers);
+static DECLARE_WAIT_QUEUE_HEAD(hub_wait);
+static u16 next_sensor_id;
+
+enum hub_groups
+{
+    HUB_GROUP_SAMPLES,
+};
+static const struct genl_multicast_group hub_genl_groups[] = {
+    [HUB_GROUP_SAMPLES] = {.name = SENSOR_HUB_GENL_GROUP},
+};
+// Nothing to ask the kernel for, the family only multicasts
+static struct genl_family hub_genl_family = {
+    .name = SENSOR_HUB_GENL_NAME,
+    .version = SENSOR_HUB_GENL_VERSION,
+    .maxattr = SENSOR_HUB_ATTR_MAX,
+    .module = THIS_MODULE,
+    .mcgrps = hub_genl_groups,
+    .n_mcgrps = ARRAY_SIZE(hub_genl_groups),
+};
+// sensor_hub_publish may run in hard irq context, where we can't multicast. Records go
+// through here (protected by hub_lock) to a work item that sends them in batches
+static DEFINE_KFIFO(netlink_fifo, struct sensor_hub_record, NETLINK_RECORDS);
+static void netlink_send(struct work_struct *work);
+static DECLARE_WORK(netlink_work, netlink_send);
+
+// Snapshot being taken, protected by hub_lock. pending counts the captures that haven't
+// finished, a trigger while there are any is dropped
+static struct
+{
+    unsigned int pending;
+    u64 timestamp;
+    u32 taking_part;
+    s32 values[SENSOR_HUB_VALUES];
+} snapshot;
+static struct sensor_hub_sensor snapshot_sensor;
+static struct hrtimer snapshot_timer;
+static void snapshot_capture(struct work_struct *work);
+static void snapshot_trigger(void);
+static void snapshot_done(struct sensor_hub_sensor *sensor, const s32 *values);
+
+// Called with hub_lock held. When the reader is full the new record is dropped, taking the
+// oldest one out would race with read()
+static void queue_record(struct sensor_hub_reader *reader, const struct sensor_hub_record *record)
+{
+    struct sensor_hub_record queued = *record;
+    if (kfifo_is_full(&reader->fifo))
+    {
+        reader->overrun = true;
+        return;
+    }
+    if (reader->overrun)
+    {
+        queued.flags |= SENSOR_HUB_OVERRUN;
+        reader->overrun = false;
+    }
+    kfifo_put(&reader->fifo, queued);
+}
+
+// One message per batch: the cost of a sample no longer depends on how many processes listen,
+// netlink only clones the message for each of them
+static void netlink_send(struct work_struct *work)
+{
+    struct sensor_hub_record record;
+    unsigned long irq_flags;
+    struct sk_buff *skb;
+    void *header;
+    bool more = true;
+    while (more)
+    {
+        unsigned int batched = 0;
+        skb = genlmsg_new(SENSOR_HUB_GENL_BATCH * nla_total_size(sizeof(struct sensor_hub_record)), GFP_KERNEL);
+        if (skb == NULL)
+            break;
+        header = genlmsg_put(skb, 0, 0, &hub_genl_family, 0, SENSOR_HUB_CMD_SAMPLES);
+        if (header == NULL)
+        {
+            nlmsg_free(skb);
+            break;
+        }
+        while (batched < SENSOR_HUB_GENL_BATCH)
+        {
+            spin_lock_irqsave(&hub_lock, irq_flags);
+            more = kfifo_get(&netlink_fifo, &record);
+            spin_unlock_irqrestore(&hub_lock, irq_flags);
+            if (!more)
+                break;
+            if (nla_put(skb, SENSOR_HUB_ATTR_RECORD, sizeof(record), &record))
+                break;
+            batched++;
+        }
+        if (batched == 0)
+        {
+            nlmsg_free(skb);
+            break;
+        }
+        genlmsg_end(skb, header);
+        // Fails with ESRCH when everyone left in the meantime, there is nothing to do about it
+        genlmsg_multicast(&hub_genl_family, skb, 0, HUB_GROUP_SAMPLES, GFP_KERNEL);
+    }
+}
+
+int sensor_hub_register(struct sensor_hub_sensor *sensor, enum sensor_hub_type type)
+{
+    unsigned long irq_flags;
+    if (sensor->capture_ops != NULL)
+        INIT_WORK(&sensor->capture_work, snapshot_capture);
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    sensor->id = next_sensor_id++;
+    sensor->type = type;
+    sensor->has_last = false;
+    list_add_tail(&sensor->list, &hub_sensors);
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+    return 0;
+}
+EXPORT_SYMBOL_GPL(sensor_hub_register);
+
+void sensor_hub_unregister(struct sensor_hub_sensor *sensor)
+{
+    unsigned long irq_flags;
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    list_del(&sensor->list);
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+    // A snapshot still waiting for this sensor goes out without it
+    if (sensor->capture_ops != NULL && cancel_work_sync(&sensor->capture_work))
+        snapshot_done(sensor, NULL);
+}
+EXPORT_SYMBOL_GPL(sensor_hub_unregister);
+
+static void publish_record(struct sensor_hub_sensor *sensor, u32 flags, const s32 *values, unsigned int count,
+                           u64 timestamp)
+{
+    struct sensor_hub_record record = {
+        .version = SENSOR_HUB_RECORD_VERSION,
+        .type = sensor->type,
+        .sensor_id = sensor->id,
+        .flags = flags,
+        .timestamp = timestamp,
+    };
+    struct sensor_hub_reader *reader;
+    unsigned long irq_flags;
+    bool multicast;
+    memcpy(record.value, values, min_t(unsigned int, count, SENSOR_HUB_VALUES) * sizeof(s32));
+    // Only a bit test, when nobody subscribed the record never goes near netlink
+    multicast = genl_has_listeners(&hub_genl_family, &init_net, HUB_GROUP_SAMPLES);
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    sensor->last = record;
+    sensor->has_last = true;
+    list_for_each_entry(reader, &hub_readers, list)
+        queue_record(reader, &record);
+    if (multicast)
+        multicast = kfifo_put(&netlink_fifo, record);
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+    wake_up_interruptible(&hub_wait);
+    if (multicast)
+        schedule_work(&netlink_work);
+}
+
+void sensor_hub_publish(struct sensor_hub_sensor *sensor, u32 flags, const s32 *values, unsigned int count)
+{
+    publish_record(sensor, flags, values, count, ktime_get_real_ns());
+    if (sensor->type == SENSOR_HUB_KY004 && (flags & SENSOR_HUB_VALID) && READ_ONCE(snapshot_on_press))
+        snapshot_trigger();
+}
+EXPORT_SYMBOL_GPL(sensor_hub_publish);
+
+static u32 snapshot_bit(u8 type)
+{
+    switch (type)
+    {
+    case SENSOR_HUB_DHT11:
+        return SENSOR_HUB_SNAPSHOT_DHT11;
+    case SENSOR_HUB_MQ135:
+        return SENSOR_HUB_SNAPSHOT_MQ135;
+    default:
+        return 0;
+    }
+}
+
+// Safe from any context like sensor_hub_publish. The captures go to the unbound workqueue so
+// they run at the same time on different CPUs instead of one after the other
+static void snapshot_trigger(void)
+{
+    struct sensor_hub_sensor *sensor;
+    unsigned long irq_flags;
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    if (snapshot.pending > 0)
+    {
+        spin_unlock_irqrestore(&hub_lock, irq_flags);
+        pr_debug("Snapshot still being taken, trigger dropped\n");
+        return;
+    }
+    snapshot.timestamp = ktime_get_real_ns();
+    snapshot.taking_part = 0;
+    memset(snapshot.values, 0, sizeof(snapshot.values));
+    list_for_each_entry(sensor, &hub_sensors, list)
+    {
+        if (sensor->capture_ops == NULL || snapshot_bit(sensor->type) == 0)
+            continue;
+        if (!queue_work(system_unbound_wq, &sensor->capture_work))
+            continue;
+        snapshot.taking_part |= snapshot_bit(sensor->type);
+        snapshot.pending++;
+    }
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+}
+
+// values is NULL when the capture failed. The last capture to finish publishes the snapshot
+static void snapshot_done(struct sensor_hub_sensor *sensor, const s32 *values)
+{
+    s32 snapshot_values[SENSOR_HUB_VALUES];
+    unsigned long irq_flags;
+    u64 timestamp = 0;
+    u32 flags = 0;
+    bool complete;
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    if (values != NULL)
+    {
+        if (sensor->type == SENSOR_HUB_DHT11)
+        {
+            snapshot.values[0] = values[0];
+            snapshot.values[1] = values[1];
+        }
+        else
+        {
+            snapshot.values[2] = values[0];
+        }
+        snapshot.values[3] |= snapshot_bit(sensor->type);
+    }
+    complete = --snapshot.pending == 0;
+    if (complete)
+    {
+        memcpy(snapshot_values, snapshot.values, sizeof(snapshot_values));
+        timestamp = snapshot.timestamp;
+        flags = snapshot.values[3] == snapshot.taking_part ? SENSOR_HUB_VALID : 0;
+    }
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+    if (complete)
+        publish_record(&snapshot_sensor, flags, snapshot_values, SENSOR_HUB_VALUES, timestamp);
+}
+
+static void snapshot_capture(struct work_struct *work)
+{
+    struct sensor_hub_sensor *sensor = container_of(work, struct sensor_hub_sensor, capture_work);
+    s32 values[SENSOR_HUB_VALUES] = {0};
+    bool valid = sensor->capture_ops->capture(sensor, values);
+    snapshot_done(sensor, valid ? values : NULL);
+}
+
+static enum hrtimer_restart snapshot_timer_expired(struct hrtimer *timer)
+{
+    snapshot_trigger();
+    hrtimer_forward_now(timer, ms_to_ktime(snapshot_period_ms));
+    return HRTIMER_RESTART;
+}
+
+static int hub_open(struct inode *inode, struct file *flip)
+{
+    struct sensor_hub_reader *reader;
+    struct sensor_hub_sensor *sensor;
+    unsigned long irq_flags;
+    reader = kzalloc(sizeof(struct sensor_hub_reader), GFP_KERNEL);
+    if (reader == NULL)
+        return -ENOMEM;
+    INIT_KFIFO(reader->fifo);
+    mutex_init(&reader->read_mutex);
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    // Start with the newest record of every sensor
+    list_for_each_entry(sensor, &hub_sensors, list)
+        if (sensor->has_last)
+            queue_record(reader, &sensor->last);
+    list_add_tail(&reader->list, &hub_readers);
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+    flip->private_data = reader;
+    return nonseekable_open(inode, flip);
+}
+static int hub_release(struct inode *inode, struct file *flip)
+{
+    struct sensor_hub_reader *reader = flip->private_data;
+    unsigned long irq_flags;
+    spin_lock_irqsave(&hub_lock, irq_flags);
+    list_del(&reader->list);
+    spin_unlock_irqrestore(&hub_lock, irq_flags);
+    kfree(reader);
+    return 0;
+}
+// Returns as many whole records as fit in buf, blocking until there is at least one
+static ssize_t hub_read(struct file *flip, char __user *buf, size_t count, loff_t *off)
+{
+    struct sensor_hub_reader *reader = flip->private_data;
+    unsigned int copied;
+    int ret;
+    if (count < sizeof(struct sensor_hub_record))
+        return -EINVAL;
+    if (mutex_lock_interruptible(&reader->read_mutex))
+        return -ERESTARTSYS;
+    while (kfifo_is_empty(&reader->fifo))
+    {
+        mutex_unlock(&reader->read_mutex);
+        if (flip->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(hub_wait, !kfifo_is_empty(&reader->fifo)))
+            return -ERESTARTSYS;
+        if (mutex_lock_interruptible(&reader->read_mutex))
+            return -ERESTARTSYS;
+    }
+    ret = kfifo_to_user(&reader->fifo, buf, count - count % sizeof(struct sensor_hub_record), &copied);
+    mutex_unlock(&reader->read_mutex);
+    return ret ? ret : copied;
+}
+static __poll_t hub_poll(struct file *flip, poll_table *wait)
+{
+    struct sensor_hub_reader *reader = flip->private_data;
+    poll_wait(flip, &hub_wait, wait);
+    return kfifo_is_empty(&reader->fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+static const struct file_operations hub_fops = {
+    .owner = THIS_MODULE,
+    .llseek = no_llseek,
+    .open = hub_open,
+    .release = hub_release,
+    .read = hub_read,
+    .poll = hub_poll,
+};
+static struct miscdevice hub_device = {
+    .minor = MISC_DYNAMIC_MINOR,
+    .name = DEVICE_NAME,
+    .mode = 0444,
+    .fops = &hub_fops,
+};
+
+static int __init sensor_hub_init(void)
+{
+    int error = genl_register_family(&hub_genl_family);
+    if (error)
+    {
+        pr_err("Could not register the %s netlink family\n", SENSOR_HUB_GENL_NAME);
+        return error;
+    }
+    error = misc_register(&hub_device);
+    if (error)
+    {
+        pr_err("Could not register the sensor hub device\n");
+        genl_unregister_family(&hub_genl_family);
+        return error;
+    }
+    sensor_hub_register(&snapshot_sensor, SENSOR_HUB_SNAPSHOT);
+    hrtimer_init(&snapshot_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    snapshot_timer.function = snapshot_timer_expired;
+    if (snapshot_period_ms > 0 && snapshot_period_ms < SNAPSHOT_MIN_PERIOD_MS)
+    {
+        pr_warn("snapshot_period_ms %u is too short, using %u\n", snapshot_period_ms, SNAPSHOT_MIN_PERIOD_MS);
+        snapshot_period_ms = SNAPSHOT_MIN_PERIOD_MS;
+    }
+    if (snapshot_period_ms > 0)
+        hrtimer_start(&snapshot_timer, ms_to_ktime(snapshot_period_ms), HRTIMER_MODE_REL);
+    pr_info("Sensor hub loaded\n");
+    return 0;
+}
+static void __exit sensor_hub_exit(void)
+{
+    hrtimer_cancel(&snapshot_timer);
+    misc_deregister(&hub_device);
+    // No driver can publish anymore, they all depend on us, and their captures went with them
+    sensor_hub_unregister(&snapshot_sensor);
+    cancel_work_sync(&netlink_work);
+    genl_unregister_family(&hub_genl_family);
+    pr_info("Sensor hub unloaded\n");
+}
+module_init(sensor_hub_init);
+module_exit(sensor_hub_exit);
+MODULE_AUTHOR("Camila Alvarez<cam.alvarez.i@gmail.com>");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,41 @@
+#ifndef SENSOR_HUB_H
+#define SENSOR_HUB_H
+
+// Drivers register their sensors with the hub and publish every new measurement, the hub
+// hands them to every reader of /dev/sensor_hub as a struct sensor_hub_record and multicasts
+// them on the "homedomotics" generic netlink family when someone subscribed. Sensors that can be
+// sampled on demand also take part in the hub's snapshots.
+
+#include <linux/list.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+#include "../include/sensor-hub-data.h"
+
+struct sensor_hub_sensor;
+struct sensor_hub_capture_ops
+{
+    // Samples the sensor right now, from a work item so it can sleep. values are laid out like
+    // the sensor's own records. Returns true when they are valid
+    bool (*capture)(struct sensor_hub_sensor *sensor, s32 *values);
+};
+
+struct sensor_hub_sensor
+{
+    struct list_head list;
+    u16 id;
+    u8 type;
+    // Newest record, new readers get it first so they start with the current state
+    bool has_last;
+    struct sensor_hub_record last;
+    // Set before sensor_hub_register for sensors that take part in snapshots, NULL otherwise
+    const struct sensor_hub_capture_ops *capture_ops;
+    struct work_struct capture_work;
+};
+
+int sensor_hub_register(struct sensor_hub_sensor *sensor, enum sensor_hub_type type);
+// Waits for a snapshot capture of the sensor to finish, don't call it from the capture
+void sensor_hub_unregister(struct sensor_hub_sensor *sensor);
+// Safe from any context, including hard irq handlers. Missing values are 0
+void sensor_hub_publish(struct sensor_hub_sensor *sensor, u32 flags, const s32 *values, unsigned int count);
+
+#endif
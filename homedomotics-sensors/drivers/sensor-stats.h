@@ -0,0 +1,150 @@
+#ifndef SENSOR_STATS_H
+#define SENSOR_STATS_H
+
+// Per-device statistics under debugfs. Every module includes its own copy, the counters
+// are per-CPU so the hot paths only do a this_cpu_inc without taking any lock.
+//
+// <debugfs>/<driver>-<device>/counters   one "name value" line per counter
+// <debugfs>/<driver>-<device>/<histogram> log2 buckets: "[low, high) count"
+// <debugfs>/<driver>-<device>/reset      write anything to clear everything
+
+#include <linux/debugfs.h>
+#include <linux/device.h>
+#include <linux/fs.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/bitops.h>
+#include <linux/string.h>
+
+#define SENSOR_STATS_MAX_COUNTERS 8
+#define SENSOR_STATS_MAX_HISTOGRAMS 4
+#define SENSOR_STATS_BUCKETS 40
+
+struct sensor_stats_cpu
+{
+    u64 counters[SENSOR_STATS_MAX_COUNTERS];
+    u64 histograms[SENSOR_STATS_MAX_HISTOGRAMS][SENSOR_STATS_BUCKETS];
+};
+struct sensor_stats;
+struct sensor_stats_histogram
+{
+    struct sensor_stats *stats;
+    unsigned int index;
+};
+struct sensor_stats
+{
+    struct dentry *dir;
+    struct sensor_stats_cpu __percpu *cpu;
+    const char *const *counter_names;
+    unsigned int counters;
+    const char *const *histogram_names;
+    unsigned int histograms;
+    struct sensor_stats_histogram histogram_files[SENSOR_STATS_MAX_HISTOGRAMS];
+};
+
+static inline void sensor_stats_inc(struct sensor_stats *stats, unsigned int counter)
+{
+    if (stats->cpu != NULL)
+        this_cpu_inc(stats->cpu->counters[counter]);
+}
+static inline void sensor_stats_add(struct sensor_stats *stats, unsigned int counter, u64 value)
+{
+    if (stats->cpu != NULL)
+        this_cpu_add(stats->cpu->counters[counter], value);
+}
+// bucket 0 holds 0, bucket n holds [2^(n-1), 2^n)
+static inline void sensor_stats_record(struct sensor_stats *stats, unsigned int histogram, u64 value)
+{
+    unsigned int bucket = min_t(unsigned int, fls64(value), SENSOR_STATS_BUCKETS - 1);
+    if (stats->cpu != NULL)
+        this_cpu_inc(stats->cpu->histograms[histogram][bucket]);
+}
+
+static int sensor_stats_counters_show(struct seq_file *s, void *unused)
+{
+    struct sensor_stats *stats = s->private;
+    int cpu;
+    for (unsigned int i = 0; i < stats->counters; i++)
+    {
+        u64 total = 0;
+        for_each_possible_cpu(cpu)
+            total += per_cpu_ptr(stats->cpu, cpu)->counters[i];
+        seq_printf(s, "%s %llu\n", stats->counter_names[i], total);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sensor_stats_counters);
+
+static int sensor_stats_histogram_show(struct seq_file *s, void *unused)
+{
+    struct sensor_stats_histogram *histogram = s->private;
+    struct sensor_stats *stats = histogram->stats;
+    int cpu;
+    for (unsigned int bucket = 0; bucket < SENSOR_STATS_BUCKETS; bucket++)
+    {
+        u64 total = 0;
+        for_each_possible_cpu(cpu)
+            total += per_cpu_ptr(stats->cpu, cpu)->histograms[histogram->index][bucket];
+        if (total == 0)
+            continue;
+        seq_printf(s, "[%llu, %llu) %llu\n",
+                   bucket ? 1ULL << (bucket - 1) : 0ULL, 1ULL << bucket, total);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sensor_stats_histogram);
+
+// Readers racing with the reset may see a partially cleared snapshot, which is fine for stats
+static ssize_t sensor_stats_reset_write(struct file *flip, const char __user *buf, size_t count, loff_t *off)
+{
+    struct sensor_stats *stats = flip->private_data;
+    int cpu;
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(stats->cpu, cpu), 0, sizeof(struct sensor_stats_cpu));
+    return count;
+}
+static const struct file_operations sensor_stats_reset_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = sensor_stats_reset_write,
+    .llseek = no_llseek,
+};
+
+// Stats are best effort: on failure the driver keeps working and the helpers do nothing
+static inline void sensor_stats_init(struct sensor_stats *stats, const char *driver, struct device *dev,
+                                     const char *const *counter_names, unsigned int counters,
+                                     const char *const *histogram_names, unsigned int histograms)
+{
+    char name[64];
+    memset(stats, 0, sizeof(struct sensor_stats));
+    stats->counter_names = counter_names;
+    stats->counters = min_t(unsigned int, counters, SENSOR_STATS_MAX_COUNTERS);
+    stats->histogram_names = histogram_names;
+    stats->histograms = min_t(unsigned int, histograms, SENSOR_STATS_MAX_HISTOGRAMS);
+    stats->cpu = alloc_percpu(struct sensor_stats_cpu);
+    if (stats->cpu == NULL)
+    {
+        dev_warn(dev, "Could not allocate statistics\n");
+        return;
+    }
+    snprintf(name, sizeof(name), "%s-%s", driver, dev_name(dev));
+    stats->dir = debugfs_create_dir(name, NULL);
+    debugfs_create_file("counters", 0444, stats->dir, stats, &sensor_stats_counters_fops);
+    for (unsigned int i = 0; i < stats->histograms; i++)
+    {
+        stats->histogram_files[i].stats = stats;
+        stats->histogram_files[i].index = i;
+        debugfs_create_file(histogram_names[i], 0444, stats->dir, &stats->histogram_files[i],
+                            &sensor_stats_histogram_fops);
+    }
+    debugfs_create_file("reset", 0200, stats->dir, stats, &sensor_stats_reset_fops);
+}
+static inline void sensor_stats_remove(struct sensor_stats *stats)
+{
+    debugfs_remove_recursive(stats->dir);
+    stats->dir = NULL;
+    free_percpu(stats->cpu);
+    stats->cpu = NULL;
+}
+
+#endif
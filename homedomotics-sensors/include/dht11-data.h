@@ -1,6 +1,8 @@
 #ifndef DHT11_DATA
 #define DHT11_DATA
 
+#include <linux/ioctl.h>
+
 #define DHT11_CHAR_DEVICE "/dev/dht11_module"
 
 struct dht11_measurement
@@ -11,4 +13,28 @@ struct dht11_measurement
     unsigned char temperature;
     unsigned char temperature_decimal;
 };
+
+// Change detection for one open file. Once a filter is set the driver samples on its own and
+// poll() only reports the file readable when a new measurement passes it, read() then returns
+// that measurement without touching the sensor. Every field at 0 passes any change.
+struct dht11_filter
+{
+    // Smallest change that is reported, in hundredths of a degree and of %RH (0 disables)
+    unsigned int temperature_delta;
+    unsigned int humidity_delta;
+    // Smallest change relative to the last reported value, in thousandths (0 disables)
+    unsigned int relative_delta;
+    // Added to the deltas when a value turns back, so a reading flipping between two
+    // counts is not reported every time. In hundredths
+    unsigned int hysteresis;
+    // After this many ms without a report the next measurement is reported anyway (0 disables)
+    unsigned int max_silence_ms;
+};
+
+#define IOCTL_DHT11_MAGIC 0xA9
+#define IOCTL_DHT11_SET_FILTER _IOW(IOCTL_DHT11_MAGIC, 0, struct dht11_filter)
+#define IOCTL_DHT11_GET_FILTER _IOR(IOCTL_DHT11_MAGIC, 1, struct dht11_filter)
+// Back to a plain reader, every read() returns the newest measurement again
+#define IOCTL_DHT11_CLEAR_FILTER _IO(IOCTL_DHT11_MAGIC, 2)
+#define IOCTL_DHT11_MAXCMD 2
 #endif
\ No newline at end of file
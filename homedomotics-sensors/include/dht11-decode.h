@@ -0,0 +1,50 @@
+#ifndef DHT11_DECODE
+#define DHT11_DECODE
+
+// Decoding of a DHT11 frame from the pulse lengths measured by the driver. It has no
+// dependencies so the same code runs in the kernel module and in userspace tools.
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define DHT11_FRAME_BITS 40
+#define DHT11_HUMIDITY 0
+#define DHT11_HUMIDITY_DECIMAL 1
+#define DHT11_TEMPERATURE 2
+#define DHT11_TEMPERATURE_DECIMAL 3
+#define DHT11_CHECKSUM 4
+
+// Every bit is a low pulse followed by a high one: a high pulse longer than the low one
+// is a 1. The 40 bits end up MSB first in the low 40 bits of the result.
+static inline uint64_t dht11_decode_frame(const uint32_t *low, const uint32_t *high)
+{
+    uint64_t frame = 0;
+    for (unsigned int i = 0; i < DHT11_FRAME_BITS; i++)
+        frame = (frame << 1) | (uint64_t)(low[i] < high[i]);
+    return frame;
+}
+// byte 0 is humidity, 4 is the checksum
+static inline uint8_t dht11_frame_byte(uint64_t frame, unsigned int byte)
+{
+    return (uint8_t)(frame >> (8 * (DHT11_CHECKSUM - byte)));
+}
+// The checksum is the low 8 bits of the sum of the other four bytes
+static inline uint8_t dht11_frame_checksum(uint64_t frame)
+{
+    return (uint8_t)(dht11_frame_byte(frame, DHT11_HUMIDITY) + dht11_frame_byte(frame, DHT11_HUMIDITY_DECIMAL) +
+                     dht11_frame_byte(frame, DHT11_TEMPERATURE) + dht11_frame_byte(frame, DHT11_TEMPERATURE_DECIMAL));
+}
+static inline int dht11_frame_valid(uint64_t frame)
+{
+    return dht11_frame_checksum(frame) == dht11_frame_byte(frame, DHT11_CHECKSUM);
+}
+// The decimal byte holds the digits after the point: 5 is .5 and 25 is .25
+static inline int32_t dht11_to_hundredths(uint8_t value, uint8_t decimal)
+{
+    return value * 100 + decimal * (decimal < 10 ? 10 : 1);
+}
+
+#endif
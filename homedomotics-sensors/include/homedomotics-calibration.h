@@ -0,0 +1,55 @@
+#ifndef HOMEDOMOTICS_CALIBRATION
+#define HOMEDOMOTICS_CALIBRATION
+
+#include <stddef.h>
+
+// MQ135 raw ADS1115 counts (struct mq135_measurement's air_quality) to CO2 equivalent ppm.
+// The sensor resistance Rs comes from the count through the PGA range, the supply and the load
+// resistor, and ppm = a * (Rs / R0)^b. Temperature and humidity change Rs by a factor the
+// conversion divides out. Everything is worked out into fixed point tables when the calibration
+// is allocated, converting is a table lookup with linear interpolation per sample, in loops
+// without branches the compiler can vectorize.
+
+// Curve fitted to the MQ135 datasheet for CO2
+#define SENSORS_CALIBRATION_A 116.6020682
+#define SENSORS_CALIBRATION_B -2.769034857
+// CO2 in clean air, what sensors_calibration_r0 takes the sensor to be breathing
+#define SENSORS_CALIBRATION_ATMOSPHERIC_PPM 397.13
+
+// CONFIG_PGA_DEFAULT is +-2.048V
+#define SENSORS_CALIBRATION_DEFAULT_FULL_SCALE_MV 2048
+#define SENSORS_CALIBRATION_DEFAULT_SUPPLY_MV 5000
+#define SENSORS_CALIBRATION_DEFAULT_LOAD_OHMS 10000
+#define SENSORS_CALIBRATION_DEFAULT_R0_OHMS 76630
+
+typedef struct sensors_calibration_config
+{
+    // ADS1115 full scale range, for the PGA setting the driver uses
+    unsigned int full_scale_mv;
+    // What the MQ135 module is fed with
+    unsigned int supply_mv;
+    // Load resistor of the module
+    unsigned int load_ohms;
+    // Sensor resistance in clean air, see sensors_calibration_r0
+    unsigned int r0_ohms;
+} SensorsCalibrationConfig;
+
+struct sensors_calibration;
+
+// config can be NULL for the defaults. Returns NULL on failure (errno is set, EINVAL for a
+// config that doesn't make sense)
+struct sensors_calibration *sensors_calibration_alloc(const SensorsCalibrationConfig *config);
+void sensors_calibration_free(struct sensors_calibration *calibration);
+// Converts n counts. Counts below 0 (noise around 0V) give 0 ppm
+void sensors_calibration_ppm(const struct sensors_calibration *calibration, const int *counts, float *ppm,
+                             size_t n);
+// Same, compensating every sample for its temperature and humidity, in hundredths like the
+// SensorsSamples columns. Values outside -10C to 70C and 0 to 100%RH are clamped
+void sensors_calibration_ppm_compensated(const struct sensors_calibration *calibration, const int *counts,
+                                         const int *temperature, const int *humidity, float *ppm, size_t n);
+// R0 in ohms for a sensor reading count in clean air at the given temperature and humidity
+// (in hundredths), or -1 when count is not between 0V and the supply. Average a few minutes
+// of readings after the sensor warmed up. config->r0_ohms is not used
+double sensors_calibration_r0(const SensorsCalibrationConfig *config, int count, int temperature, int humidity);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef HOMEDOMOTICS_NETLINK
+#define HOMEDOMOTICS_NETLINK
+
+#include <stddef.h>
+#include "sensor-hub-data.h"
+
+// Subscription to the samples the sensor hub multicasts over generic netlink. The kernel
+// pushes every new DHT11, MQ135 and KY-004 record, no device is ever read.
+
+struct sensors_netlink;
+
+// Resolves the family and joins its samples group. Returns NULL on failure (errno is set),
+// ENOENT means the sensor-hub module is not loaded
+struct sensors_netlink *sensors_netlink_open(void);
+// To add to an epoll set, readable when sensors_netlink_receive won't block
+int sensors_netlink_fd(struct sensors_netlink *subscriber);
+// Waits for the next message and copies its records, max should be at least
+// SENSOR_HUB_GENL_BATCH or records are lost. Returns how many were copied, or -1 with
+// errno ENOBUFS when the socket overflowed and samples were lost (it keeps working after that)
+int sensors_netlink_receive(struct sensors_netlink *subscriber, struct sensor_hub_record *records, size_t max);
+void sensors_netlink_close(struct sensors_netlink *subscriber);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef HOMEDOMOTICS_RECORDING
+#define HOMEDOMOTICS_RECORDING
+
+#include "homedomotics-sensors.h"
+
+// Raw device output with the time it was read, as written by homedomotics-record and served
+// again by homedomotics-replay. A recording is a small header followed by fixed size events,
+// oldest first.
+
+#define SENSORS_RECORDING_MAGIC 0x48524543
+#define SENSORS_RECORDING_VERSION 1
+
+enum sensors_event_type
+{
+    SENSORS_EVENT_DHT11 = 1,
+    SENSORS_EVENT_MQ135 = 2,
+    // The LED was switched by a button press
+    SENSORS_EVENT_KY004 = 3,
+};
+
+typedef struct sensors_event
+{
+    // ns since the epoch
+    unsigned long long timestamp;
+    unsigned int type;
+    union
+    {
+        TemperatureHumidity temperature_humidity;
+        AirQuality air_quality;
+        struct
+        {
+            int on;
+            int presses;
+        } button;
+    };
+} SensorsEvent;
+
+struct sensors_recording;
+
+// Truncates path. Returns NULL on failure (errno is set)
+struct sensors_recording *sensors_recording_create(const char *path);
+// Fails with EINVAL when path is not a recording. Returns NULL on failure (errno is set)
+struct sensors_recording *sensors_recording_open(const char *path);
+// Events are buffered, they are only on disk after sensors_recording_close. Returns 0 or -1
+int sensors_recording_write(struct sensors_recording *recording, const SensorsEvent *event);
+// Returns 1 with the next event, 0 at the end or -1 on error
+int sensors_recording_read(struct sensors_recording *recording, SensorsEvent *event);
+// Back to the first event, to replay in a loop. Returns 0 or -1
+int sensors_recording_rewind(struct sensors_recording *recording);
+// Returns 0, or -1 when buffered events could not be written
+int sensors_recording_close(struct sensors_recording *recording);
+
+#endif
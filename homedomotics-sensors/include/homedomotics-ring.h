@@ -0,0 +1,54 @@
+#ifndef HOMEDOMOTICS_RING
+#define HOMEDOMOTICS_RING
+
+#include <stddef.h>
+#include <stdint.h>
+#include "homedomotics-sensors.h"
+
+// Shared-memory ring published by homedomotics-daemon. There is one writer (the daemon)
+// and any number of readers, who never write to the shared memory, so they cannot
+// slow the writer down. Readers that fall more than SENSORS_RING_SLOTS behind skip ahead.
+
+#define SENSORS_RING_SOCKET "/run/homedomotics.sock"
+#define SENSORS_RING_MAGIC 0x484f4d52
+#define SENSORS_RING_VERSION 1
+#define SENSORS_RING_SLOTS 1024
+
+// sequence is odd while the slot is being written and 2 * (n + 1) once record n is in place
+struct sensors_ring_slot
+{
+    uint64_t sequence;
+    SensorsRecord record;
+};
+struct sensors_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t record_size;
+    // next record number to be written, it's on its own cache line since readers poll it
+    _Alignas(64) uint64_t head;
+};
+struct sensors_ring_memory
+{
+    struct sensors_ring_header header;
+    _Alignas(64) struct sensors_ring_slot slots[SENSORS_RING_SLOTS];
+};
+
+struct sensors_ring_reader;
+
+// Connects to the daemon, which hands over the ring and an eventfd of our own.
+// socket_path can be NULL for SENSORS_RING_SOCKET. Returns NULL on failure (errno is set)
+struct sensors_ring_reader *sensors_ring_attach(const char *socket_path);
+// Copies up to max records we have not seen yet, oldest first. Never blocks
+size_t sensors_ring_read(struct sensors_ring_reader *reader, SensorsRecord *records, size_t max);
+// Waits until the daemon publishes something new. Returns 1, 0 on timeout or -1 on error
+int sensors_ring_wait(struct sensors_ring_reader *reader, int timeout_ms);
+// eventfd signalled on every publication, to add to an epoll set. Call sensors_ring_wait(reader, 0)
+// to clear it once it polls readable
+int sensors_ring_fd(struct sensors_ring_reader *reader);
+// Records lost because this reader fell behind
+uint64_t sensors_ring_dropped(struct sensors_ring_reader *reader);
+void sensors_ring_detach(struct sensors_ring_reader *reader);
+
+#endif
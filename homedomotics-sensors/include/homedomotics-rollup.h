@@ -0,0 +1,60 @@
+#ifndef HOMEDOMOTICS_ROLLUP
+#define HOMEDOMOTICS_ROLLUP
+
+#include <stddef.h>
+#include "homedomotics-samples.h"
+
+// Aggregates kept up to date as samples arrive, at three resolutions. Every sample updates
+// one bucket per tier, and each bucket holds count, min, max, sum and a fixed-bin histogram.
+// Histograms with the same bins merge by adding them up, so percentiles over any range of
+// buckets come from the same data. Old buckets are overwritten, every tier keeps a fixed window:
+// a day of minutes, 30 days of hours and a year of days.
+// The history in a sensors_store can be replayed through sensors_rollup_add to fill them in.
+
+enum sensors_rollup_tier
+{
+    SENSORS_ROLLUP_MINUTE,
+    SENSORS_ROLLUP_HOUR,
+    SENSORS_ROLLUP_DAY,
+    SENSORS_ROLLUP_TIERS,
+};
+enum sensors_rollup_field
+{
+    SENSORS_ROLLUP_TEMPERATURE,
+    SENSORS_ROLLUP_HUMIDITY,
+    SENSORS_ROLLUP_AIR_QUALITY,
+    SENSORS_ROLLUP_FIELDS,
+};
+
+// Values in the same units as SensorsSamples. Percentiles are accurate to one histogram bin:
+// 0.4C, 0.8% of humidity and 256 counts of air quality
+typedef struct sensors_aggregate
+{
+    // ns since the epoch, start of the first bucket included
+    unsigned long long start;
+    unsigned long long count;
+    int min;
+    int max;
+    double mean;
+    int p50;
+    int p90;
+    int p99;
+} SensorsAggregate;
+
+struct sensors_rollup;
+
+struct sensors_rollup *sensors_rollup_alloc(void);
+void sensors_rollup_free(struct sensors_rollup *rollup);
+// Adds the valid fields of every sample. Samples older than a tier's window are ignored by that tier
+void sensors_rollup_add(struct sensors_rollup *rollup, const SensorsSamples *samples);
+// Merges every bucket of the tier that starts in [from, to] (in ns). Returns 0, or -1 when
+// they hold no samples
+int sensors_rollup_query(struct sensors_rollup *rollup, enum sensors_rollup_tier tier,
+                         enum sensors_rollup_field field, unsigned long long from, unsigned long long to,
+                         SensorsAggregate *aggregate);
+// One aggregate per non-empty bucket starting in [from, to], oldest first. Returns how many were written
+size_t sensors_rollup_series(struct sensors_rollup *rollup, enum sensors_rollup_tier tier,
+                             enum sensors_rollup_field field, unsigned long long from, unsigned long long to,
+                             SensorsAggregate *aggregates, size_t max);
+
+#endif
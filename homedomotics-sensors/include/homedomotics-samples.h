@@ -0,0 +1,31 @@
+#ifndef HOMEDOMOTICS_SAMPLES
+#define HOMEDOMOTICS_SAMPLES
+
+#include <stddef.h>
+#include "homedomotics-sensors.h"
+
+#define SAMPLE_TEMPERATURE_HUMIDITY_VALID 0x01
+#define SAMPLE_AIR_QUALITY_VALID 0x02
+
+// Structure of arrays, every column lives in the same allocation.
+// Temperature and humidity are in hundredths (2350 = 23.50C, see dht11_to_hundredths), air quality is the raw ADS1115 count
+typedef struct sensors_samples
+{
+    size_t count;
+    size_t capacity;
+    unsigned long long *timestamp;
+    int *temperature;
+    int *humidity;
+    int *air_quality;
+    unsigned char *valid;
+} SensorsSamples;
+
+SensorsSamples *sensors_samples_alloc(size_t capacity);
+void sensors_samples_free(SensorsSamples *samples);
+// Converts and appends up to n records, returns how many fit
+size_t sensors_samples_append(SensorsSamples *samples, const SensorsRecord *records, size_t n);
+// Reads count samples period_ms apart. The devices are opened once for the batch and both are
+// read together through io_uring when it's available. Returns how many were read
+size_t sensors_samples_read(SensorsSamples *samples, size_t count, unsigned int period_ms);
+
+#endif
@@ -8,8 +8,19 @@
 typedef struct mq135_measurement AirQuality;
 typedef struct dht11_measurement TemperatureHumidity;
 
+// Both sensors read at the same time, timestamp in ns since the epoch
+typedef struct sensors_record
+{
+    unsigned long long timestamp;
+    TemperatureHumidity temperature_humidity;
+    AirQuality air_quality;
+} SensorsRecord;
+
 int wait_to_read(void);
 AirQuality *read_air_quality(void);
 TemperatureHumidity *read_temperature_humidity(void);
+SensorsRecord *read_all(void);
+// Same as read_all, but fills a record owned by the caller. Returns 0 or -1
+int read_all_into(SensorsRecord *record);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,276 @@
+#ifndef HOMEDOMOTICS_SENSORS_HPP
+#define HOMEDOMOTICS_SENSORS_HPP
+
+// Header-only C++20 client for the sensor devices. Everything is resolved at compile
+// time from the measurement type, there is no virtual dispatch and no heap allocation
+// besides the coroutine frames themselves.
+
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <span>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+extern "C"
+{
+#include "dht11-data.h"
+#include "ky004-data.h"
+#include "mq135-data.h"
+}
+
+namespace homedomotics
+{
+
+// Which device backs a measurement layout
+template <typename Measurement>
+struct sensor_traits;
+
+template <>
+struct sensor_traits<dht11_measurement>
+{
+    static constexpr const char *device = DHT11_CHAR_DEVICE;
+    static bool valid(const dht11_measurement &m) noexcept { return m.successful != 0; }
+};
+
+template <>
+struct sensor_traits<mq135_measurement>
+{
+    static constexpr const char *device = MQ135_DEVICE;
+    static bool valid(const mq135_measurement &m) noexcept { return m.read_data != 0; }
+};
+
+template <typename Measurement>
+concept measurement = requires { sensor_traits<Measurement>::device; };
+
+// Owns a device fd, closed on destruction
+class device
+{
+public:
+    device() noexcept = default;
+    explicit device(const char *path, int flags = O_RDONLY)
+        : fd_(::open(path, flags | O_CLOEXEC))
+    {
+        if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), path);
+    }
+    device(device &&other) noexcept : fd_(std::exchange(other.fd_, -1)) {}
+    device &operator=(device &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            fd_ = std::exchange(other.fd_, -1);
+        }
+        return *this;
+    }
+    device(const device &) = delete;
+    device &operator=(const device &) = delete;
+    ~device() { reset(); }
+
+    int fd() const noexcept { return fd_; }
+    explicit operator bool() const noexcept { return fd_ >= 0; }
+    void reset() noexcept
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// Runs coroutines on one thread: pollable devices are waited on through epoll,
+// the others are resumed on the next iteration and read from there
+class reactor
+{
+public:
+    struct waiter
+    {
+        std::coroutine_handle<> handle;
+        waiter *next = nullptr;
+    };
+
+    reactor() : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC))
+    {
+        if (epoll_fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+    reactor(const reactor &) = delete;
+    reactor &operator=(const reactor &) = delete;
+    ~reactor() { ::close(epoll_fd_); }
+
+    // The waiter lives in the suspended coroutine frame, so queuing it does not allocate
+    void schedule(waiter &w) noexcept
+    {
+        w.next = nullptr;
+        if (ready_tail_ != nullptr)
+            ready_tail_->next = &w;
+        else
+            ready_head_ = &w;
+        ready_tail_ = &w;
+    }
+    // One-shot interest in fd becoming readable
+    bool watch(int fd, waiter &w, bool &registered) noexcept
+    {
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = &w;
+        int op = registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if (::epoll_ctl(epoll_fd_, op, fd, &event) < 0)
+            return false;
+        registered = true;
+        watched_++;
+        return true;
+    }
+    // Resumes ready coroutines and waits for device events until nothing is left
+    void run()
+    {
+        epoll_event events[16];
+        while (ready_head_ != nullptr || watched_ > 0)
+        {
+            while (ready_head_ != nullptr)
+            {
+                waiter *w = ready_head_;
+                ready_head_ = w->next;
+                if (ready_head_ == nullptr)
+                    ready_tail_ = nullptr;
+                w->handle.resume();
+            }
+            if (watched_ == 0)
+                break;
+            int n = ::epoll_wait(epoll_fd_, events, 16, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            for (int i = 0; i < n; i++)
+            {
+                watched_--;
+                schedule(*static_cast<waiter *>(events[i].data.ptr));
+            }
+        }
+    }
+
+private:
+    int epoll_fd_;
+    std::size_t watched_ = 0;
+    waiter *ready_head_ = nullptr;
+    waiter *ready_tail_ = nullptr;
+};
+
+// Fire-and-forget coroutine, it starts right away and cleans up after itself
+struct task
+{
+    struct promise_type
+    {
+        task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+template <measurement Measurement>
+class sensor
+{
+public:
+    using traits = sensor_traits<Measurement>;
+
+    sensor() : device_(traits::device) {}
+
+    // Returns false when the read failed or the sensor reported an invalid sample
+    bool read(Measurement &out) const noexcept
+    {
+        // drivers return 0 on success, only errors are negative
+        if (::read(device_.fd(), &out, sizeof(Measurement)) < 0)
+            return false;
+        return traits::valid(out);
+    }
+    // Fills the span, returns how many valid samples were read
+    std::size_t read(std::span<Measurement> out) const noexcept
+    {
+        std::size_t valid = 0;
+        for (Measurement &m : out)
+            valid += read(m);
+        return valid;
+    }
+
+    struct read_awaiter
+    {
+        const sensor &self;
+        reactor &loop;
+        reactor::waiter waiter{};
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            waiter.handle = handle;
+            loop.schedule(waiter);
+        }
+        // the read runs once the reactor gets to this coroutine, empty when it failed
+        std::optional<Measurement> await_resume() const noexcept
+        {
+            Measurement result{};
+            if (!self.read(result))
+                return std::nullopt;
+            return result;
+        }
+    };
+    read_awaiter read_async(reactor &loop) const noexcept { return read_awaiter{*this, loop}; }
+
+    const device &handle() const noexcept { return device_; }
+
+private:
+    device device_;
+};
+
+using dht11 = sensor<dht11_measurement>;
+using mq135 = sensor<mq135_measurement>;
+
+// KY-004 has no read(), its fd polls readable while the button is on
+class button
+{
+public:
+    button() : device_(KY004_DEVICE, O_RDONLY | O_NONBLOCK) {}
+
+    struct press_awaiter
+    {
+        button &self;
+        reactor &loop;
+        reactor::waiter waiter{};
+        bool ok = true;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) noexcept
+        {
+            waiter.handle = handle;
+            if (!loop.watch(self.device_.fd(), waiter, self.registered_))
+            {
+                ok = false;
+                loop.schedule(waiter);
+            }
+        }
+        bool await_resume() const noexcept { return ok; }
+    };
+    press_awaiter pressed(reactor &loop) noexcept { return press_awaiter{*this, loop}; }
+
+    const device &handle() const noexcept { return device_; }
+
+private:
+    device device_;
+    bool registered_ = false;
+};
+
+} // namespace homedomotics
+
+#endif
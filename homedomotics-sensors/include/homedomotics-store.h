@@ -0,0 +1,37 @@
+#ifndef HOMEDOMOTICS_STORE
+#define HOMEDOMOTICS_STORE
+
+#include <stddef.h>
+#include "homedomotics-samples.h"
+
+// Sensor history kept in a directory of fixed-size, memory-mapped segment files.
+// Samples are grouped in blocks of up to SENSORS_STORE_BLOCK_SAMPLES, where every column is
+// delta encoded and bit packed with the width its block needs. Each segment holds a sparse
+// index (first and last timestamp of every block), so a range query only maps and decodes
+// the blocks it overlaps. Timestamps are kept with millisecond resolution.
+// At 1 Hz a month takes around 5MB.
+
+#define SENSORS_STORE_WRITE 0x01
+#define SENSORS_STORE_BLOCK_SAMPLES 256
+#define SENSORS_STORE_SEGMENT_SIZE (1 << 20)
+
+struct sensors_store;
+
+// Opens (and with SENSORS_STORE_WRITE creates) the store in directory. There can only be
+// one writer at a time, but any number of readers. Returns NULL on failure (errno is set)
+struct sensors_store *sensors_store_open(const char *directory, unsigned int flags);
+// Appends every sample. Timestamps must not go backwards, older samples fail with EINVAL.
+// Samples are kept in memory until their block is full or sensors_store_flush is called.
+// Returns 0 or -1
+int sensors_store_append(struct sensors_store *store, const SensorsSamples *samples);
+// Writes the samples still in memory as a (short) block and syncs the segment. Returns 0 or -1
+int sensors_store_flush(struct sensors_store *store);
+// Appends to out the samples with from <= timestamp <= to (in ns), oldest first, until out
+// is full. Continue from the last timestamp returned + 1 to get the rest. Returns how many
+// samples were appended
+size_t sensors_store_query(struct sensors_store *store, unsigned long long from, unsigned long long to,
+                           SensorsSamples *out);
+// Flushes a writable store before closing it
+void sensors_store_close(struct sensors_store *store);
+
+#endif
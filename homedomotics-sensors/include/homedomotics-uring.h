@@ -0,0 +1,22 @@
+#ifndef HOMEDOMOTICS_URING
+#define HOMEDOMOTICS_URING
+
+#include "homedomotics-sensors.h"
+
+// Also keep a poll armed on the KY-004 device
+#define SENSORS_URING_BUTTON 0x01
+
+struct sensors_uring;
+
+// Opens every sensor device once and registers their fds and measurement buffers
+// with an io_uring instance. Returns NULL on failure (errno is set).
+struct sensors_uring *sensors_uring_open(unsigned int flags);
+// One collection round: both reads are submitted together and reaped in bulk,
+// usually with a single io_uring_enter. button_pressed (may be NULL) is set when
+// the KY-004 poll completed during the round. Returns 0 or -errno.
+int sensors_uring_collect(struct sensors_uring *ring, SensorsRecord *record, int *button_pressed);
+// Blocks until the KY-004 poll completes. Returns 1 when pressed or -errno.
+int sensors_uring_wait_button(struct sensors_uring *ring);
+void sensors_uring_close(struct sensors_uring *ring);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef SENSOR_HUB_DATA
+#define SENSOR_HUB_DATA
+
+#include <linux/types.h>
+
+#define SENSOR_HUB_DEVICE "/dev/sensor_hub"
+#define SENSOR_HUB_RECORD_VERSION 1
+#define SENSOR_HUB_VALUES 4
+
+// flags
+#define SENSOR_HUB_VALID 0x01
+// Records were dropped before this one because the reader fell behind
+#define SENSOR_HUB_OVERRUN 0x02
+
+enum sensor_hub_type
+{
+    // value[0] temperature and value[1] humidity in hundredths
+    SENSOR_HUB_DHT11 = 1,
+    // value[0] raw ADS1115 count
+    SENSOR_HUB_MQ135 = 2,
+    // value[0] 1 when on, value[1] presses since the driver was loaded
+    SENSOR_HUB_KY004 = 3,
+    // Sampled together by the hub on a timer or a KY-004 press, see below
+    SENSOR_HUB_SNAPSHOT = 4,
+};
+
+// A SENSOR_HUB_SNAPSHOT has value[0] temperature and value[1] humidity in hundredths, value[2]
+// the raw ADS1115 count and value[3] which of them are valid. Every sensor starts sampling when
+// the snapshot is triggered and timestamp is that moment. The DHT11 bit is only set when its
+// values were read for this snapshot, not cached from an earlier read. SENSOR_HUB_VALID is set
+// when all of the sensors taking part succeeded
+#define SENSOR_HUB_SNAPSHOT_DHT11 0x01
+#define SENSOR_HUB_SNAPSHOT_MQ135 0x02
+
+// Every record has the same size and layout for every sensor, read() returns as many whole
+// records as fit in the buffer. timestamp is CLOCK_REALTIME in ns, like SensorsRecord
+struct sensor_hub_record
+{
+    __u8 version;
+    __u8 type;
+    __u16 sensor_id;
+    __u32 flags;
+    __u64 timestamp;
+    __s32 value[SENSOR_HUB_VALUES];
+} __attribute__((packed));
+
+// Every record is also multicast on this generic netlink family and group. Each message is a
+// SENSOR_HUB_CMD_SAMPLES with up to SENSOR_HUB_GENL_BATCH SENSOR_HUB_ATTR_RECORD attributes
+#define SENSOR_HUB_GENL_NAME "homedomotics"
+#define SENSOR_HUB_GENL_VERSION 1
+#define SENSOR_HUB_GENL_GROUP "samples"
+#define SENSOR_HUB_GENL_BATCH 32
+
+enum sensor_hub_genl_command
+{
+    SENSOR_HUB_CMD_UNSPEC,
+    SENSOR_HUB_CMD_SAMPLES,
+};
+enum sensor_hub_genl_attribute
+{
+    SENSOR_HUB_ATTR_UNSPEC,
+    // a struct sensor_hub_record
+    SENSOR_HUB_ATTR_RECORD,
+    __SENSOR_HUB_ATTR_MAX,
+};
+#define SENSOR_HUB_ATTR_MAX (__SENSOR_HUB_ATTR_MAX - 1)
+
+#endif
@@ -0,0 +1,538 @@
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/gpio/driver.h>
+#include <linux/gpio/machine.h>
+#include <linux/i2c.h>
+#include <linux/irq.h>
+#include <linux/irqdomain.h>
+#include <linux/irq_sim.h>
+#include <linux/interrupt.h>
+#include <linux/hrtimer.h>
+#include <linux/spinlock.h>
+#include <linux/debugfs.h>
+#include <linux/random.h>
+#include <linux/timekeeping.h>
+#include <linux/uaccess.h>
+#include "../include/mq135-data.h"
+
+// Hardware-free stand-ins for the boards the calvarez,* drivers expect: a GPIO chip that
+// answers the DHT11 handshake and carries the KY-004 button and LED, plus an I2C adapter
+// with an ADS1115 at ADS1115_ADDRESS. The real drivers bind to them by name.
+
+#define SIM_NAME "homedomotics-sim"
+#define SIM_DHT11_LINE 0
+#define SIM_BUTTON_LINE 1
+#define SIM_LED_LINE 2
+#define SIM_ALERT_RDY_LINE 3
+#define SIM_LINES 4
+// dht11-module and ky004-module platform driver names
+#define DHT11_DRIVER_NAME "platform-dht11-char"
+#define KY004_DRIVER_NAME "ky004-driver"
+
+#define DHT11_START_LOW_NS (18 * NSEC_PER_MSEC)
+#define DHT11_BITS 40
+// ack low + ack high + (low + high) per bit + final low
+#define DHT11_SEGMENTS (2 + 2 * DHT11_BITS + 1)
+#define ALERT_RDY_PULSE_NS 8000
+#define ADS1115_OS_BIT 0x8000
+#define ADS1115_MODE_BIT 0x0100
+#define ADS1115_COMP_QUE_MASK 0x0003
+
+static int dht11_temperature = 23;
+module_param(dht11_temperature, int, 0644);
+static int dht11_temperature_decimal = 5;
+module_param(dht11_temperature_decimal, int, 0644);
+static int dht11_humidity = 41;
+module_param(dht11_humidity, int, 0644);
+static int dht11_humidity_decimal = 0;
+module_param(dht11_humidity_decimal, int, 0644);
+static uint dht11_jitter_ns = 2000;
+module_param(dht11_jitter_ns, uint, 0644);
+MODULE_PARM_DESC(dht11_jitter_ns, "Maximum deviation applied to every DHT11 pulse");
+static uint dht11_bad_checksum_every;
+module_param(dht11_bad_checksum_every, uint, 0644);
+MODULE_PARM_DESC(dht11_bad_checksum_every, "Corrupt the checksum of every Nth frame (0 = never)");
+static int ads1115_value = 9000;
+module_param(ads1115_value, int, 0644);
+static uint ads1115_noise;
+module_param(ads1115_noise, uint, 0644);
+MODULE_PARM_DESC(ads1115_noise, "Maximum deviation of every ADS1115 conversion, in counts");
+static uint button_bounces = 3;
+module_param(button_bounces, uint, 0644);
+static uint bounce_interval_us = 500;
+module_param(bounce_interval_us, uint, 0644);
+static uint press_ms = 100;
+module_param(press_ms, uint, 0644);
+
+struct sim_dht11
+{
+    u64 low_since;
+    u64 low_ns;
+    u64 frame_start;
+    bool frame_active;
+    unsigned int segment;
+    u64 segment_end[DHT11_SEGMENTS];
+    unsigned int frames;
+};
+struct sim_ads1115
+{
+    u8 pointer;
+    u16 config;
+    u16 lo_thresh;
+    u16 hi_thresh;
+    s16 conversion;
+    bool converting;
+    u64 conversion_done;
+};
+struct homedomotics_sim
+{
+    spinlock_t lock;
+    struct gpio_chip chip;
+    bool output[SIM_LINES];
+    int value[SIM_LINES];
+    struct sim_dht11 dht11;
+    struct fwnode_handle *irq_fwnode;
+    struct irq_domain *irq_domain;
+    struct hrtimer button_timer;
+    unsigned int button_toggles;
+    struct i2c_adapter adapter;
+    struct sim_ads1115 ads1115;
+    struct i2c_client *mq135_client;
+    struct platform_device *dht11_pdev;
+    struct platform_device *ky004_pdev;
+    struct dentry *dir;
+};
+static struct homedomotics_sim sim;
+
+static struct gpiod_lookup_table dht11_lookup = {
+    .dev_id = DHT11_DRIVER_NAME,
+    .table = {
+        GPIO_LOOKUP(SIM_NAME, SIM_DHT11_LINE, "temperature", GPIO_ACTIVE_HIGH),
+        {},
+    },
+};
+static struct gpiod_lookup_table ky004_lookup = {
+    .dev_id = KY004_DRIVER_NAME,
+    .table = {
+        GPIO_LOOKUP(SIM_NAME, SIM_BUTTON_LINE, "button", GPIO_ACTIVE_HIGH),
+        GPIO_LOOKUP(SIM_NAME, SIM_LED_LINE, "led", GPIO_ACTIVE_HIGH),
+        {},
+    },
+};
+
+static u64 jittered(u64 duration_ns)
+{
+    s64 jitter;
+    if (dht11_jitter_ns == 0)
+        return duration_ns;
+    jitter = (s64)(get_random_u32() % (2 * dht11_jitter_ns + 1)) - dht11_jitter_ns;
+    // never let a pulse vanish
+    return max_t(s64, (s64)duration_ns + jitter, 1000);
+}
+// Called with the lock held, once the host released the line after the start signal
+static void dht11_start_frame(struct sim_dht11 *dht11, u64 now)
+{
+    u8 bytes[5];
+    u64 end = 0;
+    unsigned int segment = 0;
+    bytes[0] = dht11_humidity;
+    bytes[1] = dht11_humidity_decimal;
+    bytes[2] = dht11_temperature;
+    bytes[3] = dht11_temperature_decimal;
+    bytes[4] = bytes[0] + bytes[1] + bytes[2] + bytes[3];
+    dht11->frames++;
+    if (dht11_bad_checksum_every && dht11->frames % dht11_bad_checksum_every == 0)
+        bytes[4] ^= 0x01;
+    // 80us low and 80us high to acknowledge the start signal
+    end += jittered(80 * NSEC_PER_USEC);
+    dht11->segment_end[segment++] = end;
+    end += jittered(80 * NSEC_PER_USEC);
+    dht11->segment_end[segment++] = end;
+    // every bit is 50us low followed by 26us (0) or 70us (1) high, MSB first
+    for (unsigned int bit = 0; bit < DHT11_BITS; bit++)
+    {
+        bool one = bytes[bit / 8] & (0x80 >> (bit % 8));
+        end += jittered(50 * NSEC_PER_USEC);
+        dht11->segment_end[segment++] = end;
+        end += jittered((one ? 70 : 26) * NSEC_PER_USEC);
+        dht11->segment_end[segment++] = end;
+    }
+    end += jittered(50 * NSEC_PER_USEC);
+    dht11->segment_end[segment++] = end;
+    dht11->frame_start = now;
+    dht11->segment = 0;
+    dht11->frame_active = true;
+}
+// Even segments are low, odd ones high, the bus idles high once the frame is over
+static int dht11_level(struct sim_dht11 *dht11, u64 now)
+{
+    u64 elapsed;
+    if (!dht11->frame_active)
+        return 1;
+    elapsed = now - dht11->frame_start;
+    // the driver samples in a tight loop, so resume from the last segment
+    while (dht11->segment < DHT11_SEGMENTS && elapsed >= dht11->segment_end[dht11->segment])
+        dht11->segment++;
+    if (dht11->segment == DHT11_SEGMENTS)
+    {
+        dht11->frame_active = false;
+        return 1;
+    }
+    return dht11->segment & 1;
+}
+static void dht11_host_drive(struct sim_dht11 *dht11, int value, u64 now)
+{
+    dht11->frame_active = false;
+    if (value == 0 && dht11->low_since == 0)
+    {
+        dht11->low_since = now;
+    }
+    else if (value != 0 && dht11->low_since != 0)
+    {
+        dht11->low_ns = now - dht11->low_since;
+        dht11->low_since = 0;
+    }
+}
+static void dht11_host_release(struct sim_dht11 *dht11, u64 now)
+{
+    if (dht11->low_ns >= DHT11_START_LOW_NS)
+        dht11_start_frame(dht11, now);
+    dht11->low_ns = 0;
+    dht11->low_since = 0;
+}
+
+// ADS1115: ALERT/RDY pulses low for 8us after a conversion when both thresholds select RDY mode
+static bool ads1115_alert_rdy(struct sim_ads1115 *ads1115, u64 now)
+{
+    bool rdy_mode = (ads1115->hi_thresh & 0x8000) && !(ads1115->lo_thresh & 0x8000) &&
+                    (ads1115->config & ADS1115_COMP_QUE_MASK) != ADS1115_COMP_QUE_MASK;
+    return rdy_mode && ads1115->conversion_done != 0 && now >= ads1115->conversion_done &&
+           now < ads1115->conversion_done + ALERT_RDY_PULSE_NS;
+}
+static void ads1115_update(struct sim_ads1115 *ads1115, u64 now)
+{
+    int value = ads1115_value;
+    if (!ads1115->converting || now < ads1115->conversion_done)
+        return;
+    if (ads1115_noise)
+        value += (int)(get_random_u32() % (2 * ads1115_noise + 1)) - (int)ads1115_noise;
+    ads1115->conversion = clamp(value, -32768, 32767);
+    ads1115->converting = false;
+}
+static void ads1115_start_conversion(struct sim_ads1115 *ads1115, u64 now)
+{
+    // 8, 16, 32, 64, 128, 250, 475 and 860 SPS
+    static const unsigned int rates[] = {8, 16, 32, 64, 128, 250, 475, 860};
+    unsigned int rate = rates[(ads1115->config >> 5) & 0x7];
+    ads1115->converting = true;
+    ads1115->conversion_done = now + NSEC_PER_SEC / rate;
+}
+static u16 *ads1115_register(struct sim_ads1115 *ads1115, u8 pointer)
+{
+    switch (pointer)
+    {
+    case CONFIG_REGISTER:
+        return &ads1115->config;
+    case LO_THRESH_RWGISTER:
+        return &ads1115->lo_thresh;
+    case HI_THRESH_REGISTER:
+        return &ads1115->hi_thresh;
+    default:
+        return (u16 *)&ads1115->conversion;
+    }
+}
+static void ads1115_write(struct sim_ads1115 *ads1115, const u8 *buf, u16 len, u64 now)
+{
+    u16 *reg, value;
+    if (len == 0)
+        return;
+    ads1115->pointer = buf[0] & 0x3;
+    if (len == 1 || ads1115->pointer == CONVERSION_REGISTER)
+        return;
+    reg = ads1115_register(ads1115, ads1115->pointer);
+    // registers are written MSB first, a short write only updates the MSB
+    value = (*reg & 0x00FF) | (buf[1] << 8);
+    if (len > 2)
+        value = (value & 0xFF00) | buf[2];
+    if (ads1115->pointer == CONFIG_REGISTER)
+    {
+        *reg = value & ~ADS1115_OS_BIT;
+        // writing OS in single-shot mode starts a conversion
+        if ((value & ADS1115_OS_BIT) && (value & ADS1115_MODE_BIT))
+            ads1115_start_conversion(ads1115, now);
+        return;
+    }
+    *reg = value;
+}
+static void ads1115_read(struct sim_ads1115 *ads1115, u8 *buf, u16 len, u64 now)
+{
+    u16 value;
+    ads1115_update(ads1115, now);
+    value = *ads1115_register(ads1115, ads1115->pointer);
+    // OS reads 0 while converting and 1 when idle
+    if (ads1115->pointer == CONFIG_REGISTER)
+        value = ads1115->converting ? value & ~ADS1115_OS_BIT : value | ADS1115_OS_BIT;
+    for (u16 i = 0; i < len; i++)
+        buf[i] = i % 2 ? value & 0xFF : value >> 8;
+}
+static int sim_i2c_xfer(struct i2c_adapter *adapter, struct i2c_msg *msgs, int num)
+{
+    unsigned long flags;
+    u64 now = ktime_get_ns();
+    for (int i = 0; i < num; i++)
+    {
+        if (msgs[i].addr != ADS1115_ADDRESS)
+            return -ENXIO;
+    }
+    spin_lock_irqsave(&sim.lock, flags);
+    for (int i = 0; i < num; i++)
+    {
+        if (msgs[i].flags & I2C_M_RD)
+            ads1115_read(&sim.ads1115, msgs[i].buf, msgs[i].len, now);
+        else
+            ads1115_write(&sim.ads1115, msgs[i].buf, msgs[i].len, now);
+    }
+    spin_unlock_irqrestore(&sim.lock, flags);
+    return num;
+}
+static u32 sim_i2c_functionality(struct i2c_adapter *adapter)
+{
+    return I2C_FUNC_I2C | I2C_FUNC_SMBUS_EMUL;
+}
+static const struct i2c_algorithm sim_i2c_algo = {
+    .master_xfer = sim_i2c_xfer,
+    .functionality = sim_i2c_functionality,
+};
+
+// Called with the lock held. Raises the simulated interrupt on the edges the consumer asked for
+static void button_set(int value)
+{
+    unsigned int type;
+    int irq;
+    if (sim.value[SIM_BUTTON_LINE] == value)
+        return;
+    sim.value[SIM_BUTTON_LINE] = value;
+    irq = irq_find_mapping(sim.irq_domain, SIM_BUTTON_LINE);
+    if (irq <= 0)
+        return;
+    type = irq_get_trigger_type(irq);
+    if ((value && (type & IRQ_TYPE_EDGE_RISING)) || (!value && (type & IRQ_TYPE_EDGE_FALLING)))
+        irq_set_irqchip_state(irq, IRQCHIP_STATE_PENDING, true);
+}
+// Every expiry toggles the contact: 2 * bounces + 1 toggles leave it pressed, then it's released
+static enum hrtimer_restart button_timer_expired(struct hrtimer *timer)
+{
+    unsigned long flags;
+    u64 next_ns;
+    spin_lock_irqsave(&sim.lock, flags);
+    if (sim.button_toggles == 0)
+    {
+        button_set(0);
+        spin_unlock_irqrestore(&sim.lock, flags);
+        return HRTIMER_NORESTART;
+    }
+    button_set(!sim.value[SIM_BUTTON_LINE]);
+    sim.button_toggles--;
+    next_ns = sim.button_toggles ? (u64)bounce_interval_us * NSEC_PER_USEC : (u64)press_ms * NSEC_PER_MSEC;
+    spin_unlock_irqrestore(&sim.lock, flags);
+    hrtimer_forward_now(timer, ns_to_ktime(next_ns));
+    return HRTIMER_RESTART;
+}
+
+static int sim_get_direction(struct gpio_chip *chip, unsigned int offset)
+{
+    return sim.output[offset] ? GPIO_LINE_DIRECTION_OUT : GPIO_LINE_DIRECTION_IN;
+}
+static int sim_direction_input(struct gpio_chip *chip, unsigned int offset)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&sim.lock, flags);
+    sim.output[offset] = false;
+    if (offset == SIM_DHT11_LINE)
+        dht11_host_release(&sim.dht11, ktime_get_ns());
+    spin_unlock_irqrestore(&sim.lock, flags);
+    return 0;
+}
+static void sim_set(struct gpio_chip *chip, unsigned int offset, int value)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&sim.lock, flags);
+    sim.value[offset] = value;
+    if (offset == SIM_DHT11_LINE && sim.output[offset])
+        dht11_host_drive(&sim.dht11, value, ktime_get_ns());
+    spin_unlock_irqrestore(&sim.lock, flags);
+}
+static int sim_direction_output(struct gpio_chip *chip, unsigned int offset, int value)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&sim.lock, flags);
+    sim.output[offset] = true;
+    spin_unlock_irqrestore(&sim.lock, flags);
+    sim_set(chip, offset, value);
+    return 0;
+}
+static int sim_get(struct gpio_chip *chip, unsigned int offset)
+{
+    unsigned long flags;
+    int value;
+    u64 now = ktime_get_ns();
+    spin_lock_irqsave(&sim.lock, flags);
+    if (sim.output[offset])
+        value = sim.value[offset];
+    else if (offset == SIM_DHT11_LINE)
+        value = dht11_level(&sim.dht11, now);
+    else if (offset == SIM_ALERT_RDY_LINE)
+        value = !ads1115_alert_rdy(&sim.ads1115, now);
+    else
+        value = sim.value[offset];
+    spin_unlock_irqrestore(&sim.lock, flags);
+    return value;
+}
+static int sim_to_irq(struct gpio_chip *chip, unsigned int offset)
+{
+    if (offset != SIM_BUTTON_LINE)
+        return -ENXIO;
+    return irq_create_mapping(sim.irq_domain, offset);
+}
+
+static ssize_t press_write(struct file *flip, const char __user *buf, size_t count, loff_t *off)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&sim.lock, flags);
+    if (hrtimer_active(&sim.button_timer))
+    {
+        spin_unlock_irqrestore(&sim.lock, flags);
+        return -EBUSY;
+    }
+    sim.button_toggles = 2 * button_bounces + 1;
+    spin_unlock_irqrestore(&sim.lock, flags);
+    hrtimer_start(&sim.button_timer, 0, HRTIMER_MODE_REL);
+    return count;
+}
+static const struct file_operations press_fops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,
+    .write = press_write,
+    .llseek = no_llseek,
+};
+static int led_get(void *data, u64 *value)
+{
+    *value = sim.value[SIM_LED_LINE];
+    return 0;
+}
+DEFINE_DEBUGFS_ATTRIBUTE(led_fops, led_get, NULL, "%llu\n");
+
+static int __init homedomotics_sim_init(void)
+{
+    struct i2c_board_info mq135_info = {I2C_BOARD_INFO("mq135", ADS1115_ADDRESS)};
+    int error;
+
+    spin_lock_init(&sim.lock);
+    // power-on defaults from the datasheet, the DHT11 bus idles high
+    sim.ads1115.config = 0x8583 & ~ADS1115_OS_BIT;
+    sim.ads1115.lo_thresh = 0x8000;
+    sim.ads1115.hi_thresh = 0x7FFF;
+    sim.value[SIM_DHT11_LINE] = 1;
+    hrtimer_init(&sim.button_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    sim.button_timer.function = button_timer_expired;
+
+    sim.irq_fwnode = irq_domain_alloc_named_fwnode(SIM_NAME);
+    if (sim.irq_fwnode == NULL)
+        return -ENOMEM;
+    sim.irq_domain = irq_domain_create_sim(sim.irq_fwnode, SIM_LINES);
+    if (IS_ERR(sim.irq_domain))
+    {
+        error = PTR_ERR(sim.irq_domain);
+        goto free_fwnode;
+    }
+    sim.chip.label = SIM_NAME;
+    sim.chip.owner = THIS_MODULE;
+    sim.chip.base = -1;
+    sim.chip.ngpio = SIM_LINES;
+    sim.chip.can_sleep = false;
+    sim.chip.get_direction = sim_get_direction;
+    sim.chip.direction_input = sim_direction_input;
+    sim.chip.direction_output = sim_direction_output;
+    sim.chip.get = sim_get;
+    sim.chip.set = sim_set;
+    sim.chip.to_irq = sim_to_irq;
+    error = gpiochip_add_data(&sim.chip, &sim);
+    if (error)
+    {
+        pr_err("Could not register the simulated gpio chip\n");
+        goto remove_domain;
+    }
+    sim.adapter.owner = THIS_MODULE;
+    sim.adapter.algo = &sim_i2c_algo;
+    strscpy(sim.adapter.name, SIM_NAME, sizeof(sim.adapter.name));
+    error = i2c_add_adapter(&sim.adapter);
+    if (error)
+    {
+        pr_err("Could not register the simulated i2c adapter\n");
+        goto remove_chip;
+    }
+    gpiod_add_lookup_table(&dht11_lookup);
+    gpiod_add_lookup_table(&ky004_lookup);
+    // the drivers match these by name and bind as soon as they are loaded
+    sim.dht11_pdev = platform_device_register_simple(DHT11_DRIVER_NAME, PLATFORM_DEVID_NONE, NULL, 0);
+    if (IS_ERR(sim.dht11_pdev))
+    {
+        error = PTR_ERR(sim.dht11_pdev);
+        goto remove_lookups;
+    }
+    sim.ky004_pdev = platform_device_register_simple(KY004_DRIVER_NAME, PLATFORM_DEVID_NONE, NULL, 0);
+    if (IS_ERR(sim.ky004_pdev))
+    {
+        error = PTR_ERR(sim.ky004_pdev);
+        goto unregister_dht11;
+    }
+    // matches "calvarez,mq135" through the compatible-less i2c OF fallback
+    sim.mq135_client = i2c_new_client_device(&sim.adapter, &mq135_info);
+    if (IS_ERR(sim.mq135_client))
+    {
+        error = PTR_ERR(sim.mq135_client);
+        goto unregister_ky004;
+    }
+    sim.dir = debugfs_create_dir(SIM_NAME, NULL);
+    debugfs_create_file("press", 0200, sim.dir, NULL, &press_fops);
+    debugfs_create_file_unsafe("led", 0444, sim.dir, NULL, &led_fops);
+    pr_info("Simulated DHT11, ADS1115 and KY-004 ready\n");
+    return 0;
+unregister_ky004:
+    platform_device_unregister(sim.ky004_pdev);
+unregister_dht11:
+    platform_device_unregister(sim.dht11_pdev);
+remove_lookups:
+    gpiod_remove_lookup_table(&ky004_lookup);
+    gpiod_remove_lookup_table(&dht11_lookup);
+    i2c_del_adapter(&sim.adapter);
+remove_chip:
+    gpiochip_remove(&sim.chip);
+remove_domain:
+    irq_domain_remove_sim(sim.irq_domain);
+free_fwnode:
+    irq_domain_free_fwnode(sim.irq_fwnode);
+    return error;
+}
+static void __exit homedomotics_sim_exit(void)
+{
+    debugfs_remove_recursive(sim.dir);
+    hrtimer_cancel(&sim.button_timer);
+    i2c_unregister_device(sim.mq135_client);
+    platform_device_unregister(sim.ky004_pdev);
+    platform_device_unregister(sim.dht11_pdev);
+    gpiod_remove_lookup_table(&ky004_lookup);
+    gpiod_remove_lookup_table(&dht11_lookup);
+    i2c_del_adapter(&sim.adapter);
+    gpiochip_remove(&sim.chip);
+    irq_domain_remove_sim(sim.irq_domain);
+    irq_domain_free_fwnode(sim.irq_fwnode);
+}
+
+module_init(homedomotics_sim_init);
+module_exit(homedomotics_sim_exit);
+MODULE_AUTHOR("Camila Alvarez<cam.alvarez.i@gmail.com>");
+MODULE_DESCRIPTION("Simulated DHT11, ADS1115 and KY-004 for the homedomotics drivers");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include "../include/homedomotics-sensors.h"
+#include "../include/homedomotics-uring.h"
+#include "../include/dht11-decode.h"
+#include "../../../led_module/led_lkm.h"
+
+#define DEFAULT_ITERATIONS 1000
+#define DEFAULT_LED_DEVICE "/dev/led_test_lkm"
+// simulator debugfs file that injects a KY-004 press
+#define DEFAULT_PRESS_TRIGGER "/sys/kernel/debug/homedomotics-sim/press"
+// Longer than the driver's debounce interval, presses closer than that are ignored
+#define BUTTON_SETTLE_MS 300
+// A press that never wakes us up (lost, or rejected by the debounce) counts as an error
+#define BUTTON_TIMEOUT_MS 1000
+// frames decoded per operation in the decode micro-benchmark
+#define DECODE_FRAMES 1024
+
+enum output_format
+{
+    OUTPUT_TEXT,
+    OUTPUT_JSON,
+    OUTPUT_CSV,
+};
+struct bench_options
+{
+    const char *mode;
+    unsigned int iterations;
+    unsigned int threads;
+    enum output_format format;
+    const char *led_device;
+    const char *trigger;
+};
+struct bench_thread
+{
+    const struct bench_options *options;
+    unsigned long long *latencies;
+    unsigned int done;
+    unsigned int errors;
+};
+typedef int (*bench_op)(struct bench_thread *thread, void *state);
+struct bench_mode
+{
+    const char *name;
+    const char *description;
+    void *(*setup)(const struct bench_options *options);
+    bench_op run;
+    void (*teardown)(void *state);
+};
+
+static unsigned long long now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Single reads keep the device open, so only the read itself is measured
+static void *open_dht11(const struct bench_options *options)
+{
+    int *fd = malloc(sizeof(int));
+    if (fd != NULL && (*fd = open(DHT11_CHAR_DEVICE, O_RDONLY)) < 0)
+    {
+        free(fd);
+        return NULL;
+    }
+    return fd;
+}
+static void *open_mq135(const struct bench_options *options)
+{
+    int *fd = malloc(sizeof(int));
+    if (fd != NULL && (*fd = open(MQ135_DEVICE, O_RDONLY)) < 0)
+    {
+        free(fd);
+        return NULL;
+    }
+    return fd;
+}
+static void close_fd(void *state)
+{
+    close(*(int *)state);
+    free(state);
+}
+static int read_dht11(struct bench_thread *thread, void *state)
+{
+    struct dht11_measurement measurement;
+    return read(*(int *)state, &measurement, sizeof(struct dht11_measurement)) < 0 ? -1 : 0;
+}
+static int read_mq135(struct bench_thread *thread, void *state)
+{
+    struct mq135_measurement measurement;
+    return read(*(int *)state, &measurement, sizeof(struct mq135_measurement)) < 0 ? -1 : 0;
+}
+
+static void *no_setup(const struct bench_options *options)
+{
+    return (void *)options;
+}
+static void no_teardown(void *state)
+{
+}
+static int read_batch(struct bench_thread *thread, void *state)
+{
+    SensorsRecord record;
+    return read_all_into(&record);
+}
+
+// io_uring rings are not shared between threads, each one opens its own before the measurement
+static void *open_uring(const struct bench_options *options)
+{
+    return sensors_uring_open(0);
+}
+static void close_uring(void *state)
+{
+    sensors_uring_close(state);
+}
+static int read_uring(struct bench_thread *thread, void *state)
+{
+    SensorsRecord record;
+    return sensors_uring_collect(state, &record, NULL) < 0 ? -1 : 0;
+}
+
+// Both files stay open, the only syscall on the trigger during the measurement is the write
+// that presses the button
+struct button_state
+{
+    int button_fd;
+    int trigger_fd;
+};
+static void *open_button(const struct bench_options *options)
+{
+    struct button_state *state = malloc(sizeof(struct button_state));
+    if (state == NULL)
+        return NULL;
+    state->button_fd = open(KY004_DEVICE, O_RDONLY);
+    state->trigger_fd = open(options->trigger, O_WRONLY);
+    if (state->button_fd < 0 || state->trigger_fd < 0)
+    {
+        if (state->button_fd >= 0)
+            close(state->button_fd);
+        if (state->trigger_fd >= 0)
+            close(state->trigger_fd);
+        free(state);
+        return NULL;
+    }
+    return state;
+}
+static void close_button(void *state)
+{
+    struct button_state *button = state;
+    close(button->button_fd);
+    close(button->trigger_fd);
+    free(button);
+}
+static int press(const struct button_state *button)
+{
+    // The trigger is not seekable, every write is a press wherever the offset is
+    return write(button->trigger_fd, "1", 1) == 1 ? 0 : -1;
+}
+// Measures from the injected press until poll() wakes us up. The button is a toggle,
+// so a second press turns it back off before the next iteration
+static int wait_button(struct bench_thread *thread, void *state)
+{
+    struct button_state *button = state;
+    struct pollfd pfd = {.fd = button->button_fd, .events = POLLIN};
+    if (press(button) < 0)
+        return -1;
+    if (poll(&pfd, 1, BUTTON_TIMEOUT_MS) != 1)
+        return -1;
+    return 0;
+}
+static void release_button(struct bench_thread *thread, void *state)
+{
+    struct button_state *button = state;
+    struct pollfd pfd = {.fd = button->button_fd, .events = POLLIN};
+    usleep(BUTTON_SETTLE_MS * 1000);
+    // Unless the press got lost, the LED is on
+    if (poll(&pfd, 1, 0) == 1)
+        press(button);
+    while (poll(&pfd, 1, 0) == 1)
+        usleep(10000);
+    usleep(BUTTON_SETTLE_MS * 1000);
+}
+
+static void *open_led(const struct bench_options *options)
+{
+    int *fd = malloc(sizeof(int));
+    if (fd != NULL && (*fd = open(options->led_device, O_RDWR)) < 0)
+    {
+        free(fd);
+        return NULL;
+    }
+    return fd;
+}
+static int toggle_led(struct bench_thread *thread, void *state)
+{
+    int fd = *(int *)state;
+    if (ioctl(fd, IOCTL_POWER_ON, 0) == -1)
+        return -1;
+    return ioctl(fd, IOCTL_POWER_OFF, 0) == -1 ? -1 : 0;
+}
+
+// Pulse counts like the ones the driver measures: ~50 cycles low, ~26 or ~70 high
+struct decode_state
+{
+    uint32_t low[DECODE_FRAMES][DHT11_FRAME_BITS];
+    uint32_t high[DECODE_FRAMES][DHT11_FRAME_BITS];
+};
+// keeps the compiler from dropping the decode
+static volatile unsigned int decode_sink;
+static void *generate_frames(const struct bench_options *options)
+{
+    struct decode_state *state = malloc(sizeof(struct decode_state));
+    if (state == NULL)
+        return NULL;
+    srand(1);
+    for (unsigned int frame = 0; frame < DECODE_FRAMES; frame++)
+        for (unsigned int bit = 0; bit < DHT11_FRAME_BITS; bit++)
+        {
+            state->low[frame][bit] = 45 + rand() % 10;
+            state->high[frame][bit] = rand() % 2 ? 65 + rand() % 10 : 20 + rand() % 10;
+        }
+    return state;
+}
+static int decode_frames(struct bench_thread *thread, void *state)
+{
+    struct decode_state *frames = state;
+    unsigned int valid = 0;
+    for (unsigned int frame = 0; frame < DECODE_FRAMES; frame++)
+        valid += dht11_frame_valid(dht11_decode_frame(frames->low[frame], frames->high[frame]));
+    decode_sink = valid;
+    return 0;
+}
+static void free_state(void *state)
+{
+    free(state);
+}
+
+static const struct bench_mode modes[] = {
+    {"dht11", "single DHT11 reads", open_dht11, read_dht11, close_fd},
+    {"mq135", "single MQ135 reads", open_mq135, read_mq135, close_fd},
+    {"batch", "read_all: both sensors read concurrently", no_setup, read_batch, no_teardown},
+    {"uring", "io_uring collection rounds", open_uring, read_uring, close_uring},
+    {"button", "KY-004 press to poll() wakeup, pressed through -t (one thread)", open_button, wait_button,
+     close_button},
+    {"led", "LED on/off ioctl pairs", open_led, toggle_led, close_fd},
+    {"decode", "DHT11 frame decoding, 1024 frames per operation", generate_frames, decode_frames, free_state},
+};
+
+struct bench_run
+{
+    const struct bench_mode *mode;
+    void *state;
+    struct bench_thread thread;
+};
+static void *run_thread(void *arg)
+{
+    struct bench_run *run = arg;
+    struct bench_thread *thread = &run->thread;
+    for (unsigned int i = 0; i < thread->options->iterations; i++)
+    {
+        unsigned long long start = now_ns();
+        if (run->mode->run(thread, run->state) < 0)
+            thread->errors++;
+        else
+            thread->latencies[thread->done++] = now_ns() - start;
+        // Also after a timeout, the press may still turn the LED on late
+        if (run->mode->run == wait_button)
+            release_button(thread, run->state);
+    }
+    return NULL;
+}
+static int compare_latencies(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return (x > y) - (x < y);
+}
+static unsigned long long percentile(const unsigned long long *sorted, size_t count, double p)
+{
+    size_t index;
+    if (count == 0)
+        return 0;
+    index = (size_t)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+static void report(const struct bench_options *options, unsigned long long *latencies, size_t count,
+                   unsigned int errors, unsigned long long elapsed_ns)
+{
+    double throughput = elapsed_ns ? count * 1e9 / elapsed_ns : 0;
+    unsigned long long p50, p99, p999, max;
+    qsort(latencies, count, sizeof(unsigned long long), compare_latencies);
+    p50 = percentile(latencies, count, 0.50);
+    p99 = percentile(latencies, count, 0.99);
+    p999 = percentile(latencies, count, 0.999);
+    max = count ? latencies[count - 1] : 0;
+    switch (options->format)
+    {
+    case OUTPUT_JSON:
+        printf("{\"mode\": \"%s\", \"threads\": %u, \"operations\": %zu, \"errors\": %u, "
+               "\"ops_per_sec\": %.2f, \"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}\n",
+               options->mode, options->threads, count, errors, throughput, p50, p99, p999, max);
+        break;
+    case OUTPUT_CSV:
+        printf("mode,threads,operations,errors,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+        printf("%s,%u,%zu,%u,%.2f,%llu,%llu,%llu,%llu\n",
+               options->mode, options->threads, count, errors, throughput, p50, p99, p999, max);
+        break;
+    default:
+        printf("%s: %zu ops (%u errors) on %u threads, %.2f ops/s\n", options->mode, count, errors,
+               options->threads, throughput);
+        printf("  p50 %llu ns  p99 %llu ns  p99.9 %llu ns  max %llu ns\n", p50, p99, p999, max);
+    }
+}
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s -m mode [-n iterations] [-c threads] [-f text|json|csv] [-l led_device] [-t trigger]\n",
+            name);
+    fprintf(stderr, "Modes:\n");
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+        fprintf(stderr, "  %-8s %s\n", modes[i].name, modes[i].description);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_options options = {
+        .mode = NULL,
+        .iterations = DEFAULT_ITERATIONS,
+        .threads = 1,
+        .format = OUTPUT_TEXT,
+        .led_device = DEFAULT_LED_DEVICE,
+        .trigger = DEFAULT_PRESS_TRIGGER,
+    };
+    const struct bench_mode *mode = NULL;
+    struct bench_run *runs;
+    pthread_t *threads;
+    unsigned long long *latencies, start, elapsed;
+    size_t count = 0;
+    unsigned int errors = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:n:c:f:l:t:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            options.mode = optarg;
+            break;
+        case 'n':
+            options.iterations = atoi(optarg);
+            break;
+        case 'c':
+            options.threads = atoi(optarg);
+            break;
+        case 'f':
+            options.format = strcmp(optarg, "json") == 0 ? OUTPUT_JSON : strcmp(optarg, "csv") == 0 ? OUTPUT_CSV
+                                                                                                   : OUTPUT_TEXT;
+            break;
+        case 'l':
+            options.led_device = optarg;
+            break;
+        case 't':
+            options.trigger = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (size_t i = 0; options.mode != NULL && i < sizeof(modes) / sizeof(modes[0]); i++)
+        if (strcmp(modes[i].name, options.mode) == 0)
+            mode = &modes[i];
+    if (mode == NULL || options.iterations == 0 || options.threads == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    // There is one button: a thread's press turns off the LED another one is still polling for
+    if (mode->run == wait_button && options.threads > 1)
+    {
+        fprintf(stderr, "%s: runs on a single thread\n", mode->name);
+        return 1;
+    }
+    runs = calloc(options.threads, sizeof(struct bench_run));
+    threads = calloc(options.threads, sizeof(pthread_t));
+    latencies = calloc((size_t)options.threads * options.iterations, sizeof(unsigned long long));
+    if (runs == NULL || threads == NULL || latencies == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+    for (unsigned int i = 0; i < options.threads; i++)
+    {
+        runs[i].mode = mode;
+        runs[i].thread.options = &options;
+        runs[i].thread.latencies = latencies + (size_t)i * options.iterations;
+        if ((runs[i].state = mode->setup(&options)) == NULL)
+        {
+            fprintf(stderr, "%s: setup failed: %s\n", mode->name, strerror(errno));
+            return 1;
+        }
+    }
+    start = now_ns();
+    for (unsigned int i = 0; i < options.threads; i++)
+        pthread_create(&threads[i], NULL, run_thread, &runs[i]);
+    for (unsigned int i = 0; i < options.threads; i++)
+        pthread_join(threads[i], NULL);
+    elapsed = now_ns() - start;
+    // compact every thread's samples before sorting them together
+    for (unsigned int i = 0; i < options.threads; i++)
+    {
+        memmove(latencies + count, runs[i].thread.latencies, runs[i].thread.done * sizeof(unsigned long long));
+        count += runs[i].thread.done;
+        errors += runs[i].thread.errors;
+        mode->teardown(runs[i].state);
+    }
+    report(&options, latencies, count, errors, elapsed);
+    free(latencies);
+    free(threads);
+    free(runs);
+    return errors > 0 && count == 0;
+}
@@ -0,0 +1,57 @@
+#include <cstdio>
+#include <cstdlib>
+#include <system_error>
+#include "../../include/homedomotics-sensors.hpp"
+
+// Both sensors read from coroutines sharing one reactor, each one takes its turn on the thread
+
+static homedomotics::task read_temperature(const homedomotics::dht11 &sensor, homedomotics::reactor &loop,
+                                           int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        auto measurement = co_await sensor.read_async(loop);
+        if (!measurement)
+        {
+            printf("dht11: read failed\n");
+            continue;
+        }
+        printf("dht11: %d.%dC %d.%d%%RH\n", measurement->temperature, measurement->temperature_decimal,
+               measurement->humidity, measurement->humidity_decimal);
+    }
+}
+
+static homedomotics::task read_air_quality(const homedomotics::mq135 &sensor, homedomotics::reactor &loop,
+                                           int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        auto measurement = co_await sensor.read_async(loop);
+        if (!measurement)
+        {
+            printf("mq135: read failed\n");
+            continue;
+        }
+        printf("mq135: %d\n", measurement->air_quality);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int samples = argc > 1 ? atoi(argv[1]) : 1;
+    try
+    {
+        homedomotics::reactor loop;
+        homedomotics::dht11 dht11;
+        homedomotics::mq135 mq135;
+        read_temperature(dht11, loop, samples);
+        read_air_quality(mq135, loop, samples);
+        loop.run();
+    }
+    catch (const std::system_error &error)
+    {
+        fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
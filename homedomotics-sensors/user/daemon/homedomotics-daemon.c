@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "../include/homedomotics-sensors.h"
+#include "../include/homedomotics-uring.h"
+#include "../include/homedomotics-ring.h"
+
+// The DHT11 driver hands back its cached value when read more often than once a second
+#define DEFAULT_PERIOD_MS 1000
+#define MAX_CONSUMERS 64
+#define MAX_EVENTS 16
+
+struct consumer
+{
+    int socket_fd;
+    int event_fd;
+};
+struct daemon
+{
+    struct sensors_ring_memory *ring;
+    int ring_fd;
+    int listen_fd;
+    int timer_fd;
+    int signal_fd;
+    int epoll_fd;
+    // NULL when io_uring is not available, we go through read_all_into then
+    struct sensors_uring *uring;
+    struct consumer consumers[MAX_CONSUMERS];
+    unsigned int nconsumers;
+    unsigned long long failures;
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-p period_ms] [-s socket]\n", name);
+    fprintf(stderr, "  -p  sampling period in ms (default %d)\n", DEFAULT_PERIOD_MS);
+    fprintf(stderr, "  -s  socket consumers attach to (default %s)\n", SENSORS_RING_SOCKET);
+}
+
+// The ring lives in a memfd: consumers get the fd itself, so there is no name in /dev/shm
+// that could be left behind or opened by someone else
+static int create_ring(struct daemon *daemon)
+{
+    void *memory;
+    daemon->ring_fd = memfd_create("homedomotics-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (daemon->ring_fd < 0)
+        return -1;
+    if (ftruncate(daemon->ring_fd, sizeof(struct sensors_ring_memory)) < 0)
+        return -1;
+    memory = mmap(NULL, sizeof(struct sensors_ring_memory), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  daemon->ring_fd, 0);
+    if (memory == MAP_FAILED)
+        return -1;
+    daemon->ring = memory;
+    daemon->ring->header.magic = SENSORS_RING_MAGIC;
+    daemon->ring->header.version = SENSORS_RING_VERSION;
+    daemon->ring->header.slots = SENSORS_RING_SLOTS;
+    daemon->ring->header.record_size = sizeof(SensorsRecord);
+    // Our mapping stays writable, but consumers can only map it read only and can't resize it
+    if (fcntl(daemon->ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0)
+        return -1;
+    return 0;
+}
+
+static int create_socket(const char *path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    int fd;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, MAX_CONSUMERS) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    // Consumers only ever get read access to the ring, so anyone on the machine may attach
+    chmod(path, 0666);
+    return fd;
+}
+
+static int create_timer(unsigned int period_ms)
+{
+    struct itimerspec period = {
+        .it_interval = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+        .it_value = {.tv_nsec = 1},
+    };
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (timerfd_settime(fd, 0, &period, NULL) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int create_signals(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static int watch(int epoll_fd, int fd)
+{
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+// Every consumer gets its own eventfd so that one of them clearing it can't hide a
+// publication from the others
+static void accept_consumer(struct daemon *daemon)
+{
+    struct consumer *consumer;
+    char byte = 0;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union
+    {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg;
+    int fds[2];
+    int socket_fd = accept4(daemon->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (socket_fd < 0)
+        return;
+    if (daemon->nconsumers == MAX_CONSUMERS)
+    {
+        fprintf(stderr, "Too many consumers, dropping connection\n");
+        close(socket_fd);
+        return;
+    }
+    consumer = &daemon->consumers[daemon->nconsumers];
+    consumer->socket_fd = socket_fd;
+    consumer->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (consumer->event_fd < 0)
+        goto close_socket;
+    fds[0] = daemon->ring_fd;
+    fds[1] = consumer->event_fd;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(socket_fd, &msg, MSG_NOSIGNAL) < 0)
+        goto close_event;
+    // We keep the connection only to notice when the consumer goes away
+    if (watch(daemon->epoll_fd, socket_fd) < 0)
+        goto close_event;
+    daemon->nconsumers++;
+    return;
+close_event:
+    close(consumer->event_fd);
+close_socket:
+    close(socket_fd);
+}
+
+static void drop_consumer(struct daemon *daemon, int socket_fd)
+{
+    for (unsigned int i = 0; i < daemon->nconsumers; i++)
+    {
+        if (daemon->consumers[i].socket_fd != socket_fd)
+            continue;
+        close(daemon->consumers[i].socket_fd);
+        close(daemon->consumers[i].event_fd);
+        daemon->consumers[i] = daemon->consumers[--daemon->nconsumers];
+        return;
+    }
+}
+
+static void publish(struct daemon *daemon, const SensorsRecord *record)
+{
+    struct sensors_ring_header *header = &daemon->ring->header;
+    uint64_t head = atomic_load_explicit((_Atomic uint64_t *)&header->head, memory_order_relaxed);
+    struct sensors_ring_slot *slot = &daemon->ring->slots[head % SENSORS_RING_SLOTS];
+    uint64_t one = 1;
+    // Odd while we write, readers that copied in between throw their copy away
+    atomic_store_explicit((_Atomic uint64_t *)&slot->sequence, 2 * head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&slot->record, record, sizeof(SensorsRecord));
+    atomic_store_explicit((_Atomic uint64_t *)&slot->sequence, 2 * (head + 1), memory_order_release);
+    atomic_store_explicit((_Atomic uint64_t *)&header->head, head + 1, memory_order_release);
+    for (unsigned int i = 0; i < daemon->nconsumers; i++)
+    {
+        // Only fails when the counter would overflow, the consumer has plenty to read then
+        if (write(daemon->consumers[i].event_fd, &one, sizeof(one)) < 0)
+            continue;
+    }
+}
+
+static void sample(struct daemon *daemon)
+{
+    SensorsRecord record;
+    uint64_t expirations;
+    int ret;
+    // We may have missed ticks while reading, there is no point in catching up on them
+    if (read(daemon->timer_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+    if (daemon->uring != NULL)
+        ret = sensors_uring_collect(daemon->uring, &record, NULL);
+    else
+        ret = read_all_into(&record);
+    if (ret < 0)
+    {
+        // Only the first of a row of failures is logged
+        if (daemon->failures++ == 0)
+            perror("Could not read sensors");
+        return;
+    }
+    if (daemon->failures > 0)
+    {
+        fprintf(stderr, "Sensors are back after %llu failed reads\n", daemon->failures);
+        daemon->failures = 0;
+    }
+    publish(daemon, &record);
+}
+
+static int run(struct daemon *daemon)
+{
+    struct epoll_event events[MAX_EVENTS];
+    for (;;)
+    {
+        int ready = epoll_wait(daemon->epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return 1;
+        }
+        for (int i = 0; i < ready; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == daemon->signal_fd)
+                return 0;
+            else if (fd == daemon->timer_fd)
+                sample(daemon);
+            else if (fd == daemon->listen_fd)
+                accept_consumer(daemon);
+            else
+                drop_consumer(daemon, fd);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct daemon daemon = {.ring_fd = -1, .listen_fd = -1, .timer_fd = -1, .signal_fd = -1, .epoll_fd = -1};
+    const char *socket_path = SENSORS_RING_SOCKET;
+    unsigned int period_ms = DEFAULT_PERIOD_MS;
+    int opt, ret = 1;
+    while ((opt = getopt(argc, argv, "p:s:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            period_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            socket_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (period_ms == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (create_ring(&daemon) < 0)
+    {
+        perror("Could not create the ring");
+        goto cleanup;
+    }
+    // Keeps the devices open between samples, so a sample is a single io_uring_enter
+    daemon.uring = sensors_uring_open(0);
+    if (daemon.uring == NULL)
+        fprintf(stderr, "io_uring not available (%s), opening the devices on every sample\n", strerror(errno));
+    daemon.signal_fd = create_signals();
+    daemon.timer_fd = create_timer(period_ms);
+    daemon.listen_fd = create_socket(socket_path);
+    daemon.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (daemon.signal_fd < 0 || daemon.timer_fd < 0 || daemon.listen_fd < 0 || daemon.epoll_fd < 0)
+    {
+        perror("Could not set up the daemon");
+        goto cleanup;
+    }
+    if (watch(daemon.epoll_fd, daemon.signal_fd) < 0 || watch(daemon.epoll_fd, daemon.timer_fd) < 0 ||
+        watch(daemon.epoll_fd, daemon.listen_fd) < 0)
+    {
+        perror("epoll_ctl");
+        goto cleanup;
+    }
+    ret = run(&daemon);
+cleanup:
+    while (daemon.nconsumers > 0)
+        drop_consumer(&daemon, daemon.consumers[0].socket_fd);
+    if (daemon.listen_fd >= 0)
+    {
+        close(daemon.listen_fd);
+        unlink(socket_path);
+    }
+    if (daemon.uring != NULL)
+        sensors_uring_close(daemon.uring);
+    if (daemon.ring != NULL)
+        munmap(daemon.ring, sizeof(struct sensors_ring_memory));
+    close(daemon.epoll_fd);
+    close(daemon.timer_fd);
+    close(daemon.signal_fd);
+    close(daemon.ring_fd);
+    return ret;
+}
@@ -1,24 +1,95 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 #include "../include/dht11-data.h"
 
+static void print_measurement(const struct dht11_measurement *measurement)
+{
+    if (measurement->successful)
+        printf("Humidity: %d.%d%%RH Temperature: %d.%dC\n",
+               measurement->humidity,
+               measurement->humidity_decimal,
+               measurement->temperature,
+               measurement->temperature_decimal);
+    else
+        printf("Invalid reading\n");
+    fflush(stdout);
+}
+
+// Prints a line only when the driver says the measurement changed enough
+static int watch(int fd, const struct dht11_filter *filter)
+{
+    struct dht11_measurement measurement;
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (ioctl(fd, IOCTL_DHT11_SET_FILTER, filter) == -1)
+    {
+        perror("ioctl IOCTL_DHT11_SET_FILTER failed");
+        return 1;
+    }
+    for (;;)
+    {
+        if (poll(&pfd, 1, -1) == -1)
+        {
+            perror("poll");
+            return 1;
+        }
+        if (read(fd, &measurement, sizeof(struct dht11_measurement)) < 0)
+        {
+            perror("read");
+            return 1;
+        }
+        print_measurement(&measurement);
+    }
+}
+
 int main(int argc, char **argv)
 {
     struct dht11_measurement measurement;
-    int fd = 0;
-    if ((fd = open(DHT11_CHAR_DEVICE, O_RDONLY)) < -1)
+    struct dht11_filter filter;
+    int fd = 0, opt, filtered = 0;
+    memset(&filter, 0, sizeof(struct dht11_filter));
+    // deltas and hysteresis in hundredths, relative delta in thousandths, silence in ms
+    while ((opt = getopt(argc, argv, "t:h:r:y:s:")) != -1)
+    {
+        unsigned int value = (unsigned int)strtoul(optarg, NULL, 10);
+        switch (opt)
+        {
+        case 't':
+            filter.temperature_delta = value;
+            break;
+        case 'h':
+            filter.humidity_delta = value;
+            break;
+        case 'r':
+            filter.relative_delta = value;
+            break;
+        case 'y':
+            filter.hysteresis = value;
+            break;
+        case 's':
+            filter.max_silence_ms = value;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t temperature_delta] [-h humidity_delta] [-r relative_delta] "
+                            "[-y hysteresis] [-s max_silence_ms]\n",
+                    argv[0]);
+            return 1;
+        }
+        filtered = 1;
+    }
+    if ((fd = open(DHT11_CHAR_DEVICE, O_RDONLY)) < 0)
+    {
+        perror("open " DHT11_CHAR_DEVICE);
         return 1;
+    }
+    if (filtered)
+        return watch(fd, &filter);
     read(fd, &measurement, sizeof(struct dht11_measurement));
-    if (measurement.successful)
-        printf("Humidity: %d.%d\%RH Temperature: %d.%dC\n",
-               measurement.humidity,
-               measurement.humidity_decimal,
-               measurement.temperature,
-               measurement.temperature_decimal);
-    else
-        printf("Invalid reading\n");
+    print_measurement(&measurement);
     return 0;
 }
@@ -0,0 +1,511 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../include/homedomotics-sensors.h"
+#include "../include/dht11-decode.h"
+#include "../include/homedomotics-ring.h"
+
+// Prometheus metrics for the samples the daemon publishes in its ring. The whole response is
+// rendered once at startup with a fixed width for every value, new samples overwrite the
+// digits in place, so a scrape is one writev of a buffer that never changes size.
+
+#define DEFAULT_SOCKET "/run/homedomotics-metrics.sock"
+#define BODY_SIZE 4096
+#define HEADER_SIZE 256
+#define MAX_CLIENTS 64
+#define MAX_EVENTS 16
+#define RING_BATCH 64
+// Clients that haven't sent a whole request after this many ticks are dropped
+#define TICK_MS 1000
+#define CLIENT_TICKS 5
+
+enum metric_values
+{
+    METRIC_UP,
+    METRIC_TEMPERATURE,
+    METRIC_HUMIDITY,
+    METRIC_AIR_QUALITY,
+    METRIC_DHT11_VALID,
+    METRIC_MQ135_VALID,
+    METRIC_TIMESTAMP,
+    METRIC_SAMPLES,
+    METRIC_DHT11_INVALID,
+    METRIC_MQ135_INVALID,
+    METRIC_DROPPED,
+    METRIC_SCRAPES,
+    METRIC_VALUES,
+};
+
+struct metric
+{
+    const char *family;
+    const char *labels;
+    // Only on the first series of a family, the others share its HELP and TYPE lines
+    const char *help;
+    const char *type;
+    // Characters of the value, including the sign and the decimal point. Wide enough for any
+    // value the metric can take
+    unsigned int width;
+    unsigned int decimals;
+    int is_signed;
+};
+
+static const struct metric metrics[METRIC_VALUES] = {
+    [METRIC_UP] = {"homedomotics_up", "", "1 while the exporter is attached to the sampling daemon", "gauge", 1, 0, 0},
+    [METRIC_TEMPERATURE] = {"homedomotics_temperature_celsius", "", "Last DHT11 temperature", "gauge", 8, 2, 1},
+    [METRIC_HUMIDITY] = {"homedomotics_humidity_percent", "", "Last DHT11 relative humidity", "gauge", 8, 2, 1},
+    [METRIC_AIR_QUALITY] = {"homedomotics_air_quality_raw", "", "Last MQ135 ADS1115 count", "gauge", 7, 0, 1},
+    [METRIC_DHT11_VALID] = {"homedomotics_sample_valid", "{sensor=\"dht11\"}",
+                            "1 when the last reading of the sensor succeeded", "gauge", 1, 0, 0},
+    [METRIC_MQ135_VALID] = {"homedomotics_sample_valid", "{sensor=\"mq135\"}", NULL, NULL, 1, 0, 0},
+    [METRIC_TIMESTAMP] = {"homedomotics_last_sample_timestamp_seconds", "", "When the last sample was taken",
+                          "gauge", 14, 3, 0},
+    [METRIC_SAMPLES] = {"homedomotics_samples_total", "", "Samples read from the ring", "counter", 20, 0, 0},
+    [METRIC_DHT11_INVALID] = {"homedomotics_invalid_samples_total", "{sensor=\"dht11\"}",
+                              "Samples where the sensor could not be read", "counter", 20, 0, 0},
+    [METRIC_MQ135_INVALID] = {"homedomotics_invalid_samples_total", "{sensor=\"mq135\"}", NULL, NULL, 20, 0, 0},
+    [METRIC_DROPPED] = {"homedomotics_dropped_samples_total", "", "Samples the daemon overwrote before we read them",
+                        "counter", 20, 0, 0},
+    [METRIC_SCRAPES] = {"homedomotics_scrapes_total", "", "Scrapes served", "counter", 20, 0, 0},
+};
+
+struct client
+{
+    int fd;
+    // How much of the blank line ending the request we have seen
+    unsigned int matched;
+    unsigned long long deadline;
+};
+
+struct exporter
+{
+    char header[HEADER_SIZE];
+    size_t header_size;
+    char body[BODY_SIZE];
+    size_t body_size;
+    // Where the digits of every value start in body
+    char *values[METRIC_VALUES];
+    unsigned long long samples, dht11_invalid, mq135_invalid, scrapes;
+    // Drops counted by the readers we already detached
+    unsigned long long dropped;
+    const char *ring_path;
+    struct sensors_ring_reader *reader;
+    int unix_fd;
+    int tcp_fd;
+    int timer_fd;
+    int signal_fd;
+    int epoll_fd;
+    unsigned long long ticks;
+    struct client clients[MAX_CLIENTS];
+    unsigned int nclients;
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-s socket] [-l port] [-r ring_socket]\n", name);
+    fprintf(stderr, "  -s  unix socket scrapes are served on (default %s, empty to disable)\n", DEFAULT_SOCKET);
+    fprintf(stderr, "  -l  also serve on 127.0.0.1:port\n");
+    fprintf(stderr, "  -r  socket of the sampling daemon (default %s)\n", SENSORS_RING_SOCKET);
+}
+
+// Writes value (already scaled by 10^decimals) right to left over the metric's width,
+// padding with zeros
+static void put_value(struct exporter *exporter, enum metric_values index, long long value)
+{
+    const struct metric *metric = &metrics[index];
+    char *start = exporter->values[index];
+    char *digit = start + metric->width;
+    char *first = metric->is_signed ? start + 1 : start;
+    unsigned long long magnitude = value < 0 ? -(unsigned long long)value : (unsigned long long)value;
+    for (unsigned int position = 0; digit > first; position++)
+    {
+        if (metric->decimals != 0 && position == metric->decimals)
+        {
+            *--digit = '.';
+            continue;
+        }
+        *--digit = '0' + magnitude % 10;
+        magnitude /= 10;
+    }
+    if (metric->is_signed)
+        *start = value < 0 ? '-' : '+';
+}
+
+static int render(struct exporter *exporter)
+{
+    size_t used = 0;
+    int length;
+    for (unsigned int i = 0; i < METRIC_VALUES; i++)
+    {
+        const struct metric *metric = &metrics[i];
+        if (metric->help != NULL)
+        {
+            length = snprintf(exporter->body + used, BODY_SIZE - used, "# HELP %s %s\n# TYPE %s %s\n",
+                              metric->family, metric->help, metric->family, metric->type);
+            if (length < 0 || (size_t)length >= BODY_SIZE - used)
+                return -1;
+            used += length;
+        }
+        length = snprintf(exporter->body + used, BODY_SIZE - used, "%s%s %*s\n", metric->family, metric->labels,
+                          (int)metric->width, "");
+        if (length < 0 || (size_t)length >= BODY_SIZE - used)
+            return -1;
+        used += length;
+        exporter->values[i] = exporter->body + used - 1 - metric->width;
+        put_value(exporter, i, 0);
+    }
+    exporter->body_size = used;
+    // The body never changes size, neither does the header
+    length = snprintf(exporter->header, HEADER_SIZE,
+                      "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                      exporter->body_size);
+    if (length < 0 || length >= HEADER_SIZE)
+        return -1;
+    exporter->header_size = length;
+    return 0;
+}
+
+static void update(struct exporter *exporter, const SensorsRecord *record)
+{
+    const TemperatureHumidity *temperature_humidity = &record->temperature_humidity;
+    put_value(exporter, METRIC_SAMPLES, ++exporter->samples);
+    // Milliseconds, the timestamp metric has three decimals
+    put_value(exporter, METRIC_TIMESTAMP, record->timestamp / 1000000);
+    put_value(exporter, METRIC_DHT11_VALID, temperature_humidity->successful != 0);
+    if (temperature_humidity->successful)
+    {
+        put_value(exporter, METRIC_TEMPERATURE,
+                  dht11_to_hundredths(temperature_humidity->temperature, temperature_humidity->temperature_decimal));
+        put_value(exporter, METRIC_HUMIDITY,
+                  dht11_to_hundredths(temperature_humidity->humidity, temperature_humidity->humidity_decimal));
+    }
+    else
+        put_value(exporter, METRIC_DHT11_INVALID, ++exporter->dht11_invalid);
+    put_value(exporter, METRIC_MQ135_VALID, record->air_quality.read_data != 0);
+    if (record->air_quality.read_data)
+        put_value(exporter, METRIC_AIR_QUALITY, record->air_quality.air_quality);
+    else
+        put_value(exporter, METRIC_MQ135_INVALID, ++exporter->mq135_invalid);
+}
+
+static int watch(int epoll_fd, int fd)
+{
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = fd};
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+static void attach(struct exporter *exporter)
+{
+    exporter->reader = sensors_ring_attach(exporter->ring_path);
+    if (exporter->reader == NULL)
+        return;
+    if (watch(exporter->epoll_fd, sensors_ring_fd(exporter->reader)) < 0)
+    {
+        sensors_ring_detach(exporter->reader);
+        exporter->reader = NULL;
+        return;
+    }
+    put_value(exporter, METRIC_UP, 1);
+}
+
+static void detach(struct exporter *exporter)
+{
+    epoll_ctl(exporter->epoll_fd, EPOLL_CTL_DEL, sensors_ring_fd(exporter->reader), NULL);
+    exporter->dropped += sensors_ring_dropped(exporter->reader);
+    sensors_ring_detach(exporter->reader);
+    exporter->reader = NULL;
+    put_value(exporter, METRIC_UP, 0);
+}
+
+// Also called on every tick: the eventfd never tells us the daemon went away, the wait does
+static void drain(struct exporter *exporter)
+{
+    SensorsRecord records[RING_BATCH];
+    size_t read;
+    if (sensors_ring_wait(exporter->reader, 0) < 0)
+    {
+        detach(exporter);
+        return;
+    }
+    while ((read = sensors_ring_read(exporter->reader, records, RING_BATCH)) > 0)
+        for (size_t i = 0; i < read; i++)
+            update(exporter, &records[i]);
+    put_value(exporter, METRIC_DROPPED, exporter->dropped + sensors_ring_dropped(exporter->reader));
+}
+
+static int create_unix_socket(const char *path)
+{
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    int fd;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, MAX_CLIENTS) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    // Same values anyone could read from the devices
+    chmod(path, 0666);
+    return fd;
+}
+
+// Only on the loopback, there is no authentication whatsoever
+static int create_tcp_socket(unsigned short port)
+{
+    struct sockaddr_in address = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    int fd, reuse = 1;
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, MAX_CLIENTS) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int create_timer(void)
+{
+    struct itimerspec period = {
+        .it_interval = {.tv_sec = TICK_MS / 1000, .tv_nsec = (TICK_MS % 1000) * 1000000L},
+        .it_value = {.tv_sec = TICK_MS / 1000, .tv_nsec = (TICK_MS % 1000) * 1000000L},
+    };
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (timerfd_settime(fd, 0, &period, NULL) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int create_signals(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    // A scraper hanging up on us must not kill the exporter
+    signal(SIGPIPE, SIG_IGN);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static void accept_client(struct exporter *exporter, int listen_fd)
+{
+    struct client *client;
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (exporter->nclients == MAX_CLIENTS || watch(exporter->epoll_fd, fd) < 0)
+    {
+        close(fd);
+        return;
+    }
+    client = &exporter->clients[exporter->nclients++];
+    client->fd = fd;
+    client->matched = 0;
+    client->deadline = exporter->ticks + CLIENT_TICKS;
+}
+
+static void drop_client(struct exporter *exporter, unsigned int index)
+{
+    close(exporter->clients[index].fd);
+    exporter->clients[index] = exporter->clients[--exporter->nclients];
+}
+
+// The buffers are small enough for the socket buffer of a new connection, a short write only
+// happens to a client that is gone already
+static void respond(struct exporter *exporter, int fd)
+{
+    struct iovec response[2];
+    put_value(exporter, METRIC_SCRAPES, ++exporter->scrapes);
+    response[0].iov_base = exporter->header;
+    response[0].iov_len = exporter->header_size;
+    response[1].iov_base = exporter->body;
+    response[1].iov_len = exporter->body_size;
+    if (writev(fd, response, 2) < 0)
+        return;
+}
+
+// Any request gets the metrics, we only wait for it to end (an empty line) before answering
+static void serve(struct exporter *exporter, unsigned int index)
+{
+    static const char end[] = "\r\n\r\n";
+    struct client *client = &exporter->clients[index];
+    char request[1024];
+    ssize_t received = read(client->fd, request, sizeof(request));
+    if (received < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (received <= 0)
+    {
+        drop_client(exporter, index);
+        return;
+    }
+    for (ssize_t i = 0; i < received && client->matched < sizeof(end) - 1; i++)
+        client->matched = request[i] == end[client->matched] ? client->matched + 1 : (request[i] == '\r');
+    if (client->matched < sizeof(end) - 1)
+        return;
+    respond(exporter, client->fd);
+    drop_client(exporter, index);
+}
+
+static void tick(struct exporter *exporter)
+{
+    unsigned long long expirations;
+    if (read(exporter->timer_fd, &expirations, sizeof(expirations)) < 0)
+        return;
+    exporter->ticks += expirations;
+    if (exporter->reader != NULL)
+        drain(exporter);
+    else
+        attach(exporter);
+    for (unsigned int i = exporter->nclients; i-- > 0;)
+        if (exporter->clients[i].deadline <= exporter->ticks)
+            drop_client(exporter, i);
+}
+
+static int run(struct exporter *exporter)
+{
+    struct epoll_event events[MAX_EVENTS];
+    for (;;)
+    {
+        int ready = epoll_wait(exporter->epoll_fd, events, MAX_EVENTS, -1);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return 1;
+        }
+        for (int i = 0; i < ready; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == exporter->signal_fd)
+                return 0;
+            else if (fd == exporter->timer_fd)
+                tick(exporter);
+            else if (fd == exporter->unix_fd || fd == exporter->tcp_fd)
+                accept_client(exporter, fd);
+            else if (exporter->reader != NULL && fd == sensors_ring_fd(exporter->reader))
+                drain(exporter);
+            else
+            {
+                for (unsigned int j = 0; j < exporter->nclients; j++)
+                {
+                    if (exporter->clients[j].fd != fd)
+                        continue;
+                    serve(exporter, j);
+                    break;
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    static struct exporter exporter = {.unix_fd = -1, .tcp_fd = -1, .timer_fd = -1, .signal_fd = -1, .epoll_fd = -1};
+    const char *socket_path = DEFAULT_SOCKET;
+    unsigned long port = 0;
+    int opt, ret = 1;
+    while ((opt = getopt(argc, argv, "s:l:r:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'l':
+            port = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            exporter.ring_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (port > 65535 || (socket_path[0] == '\0' && port == 0))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (render(&exporter) < 0)
+    {
+        fprintf(stderr, "The metrics don't fit in %d bytes\n", BODY_SIZE);
+        return 1;
+    }
+    exporter.signal_fd = create_signals();
+    exporter.timer_fd = create_timer();
+    exporter.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (socket_path[0] != '\0')
+        exporter.unix_fd = create_unix_socket(socket_path);
+    if (port != 0)
+        exporter.tcp_fd = create_tcp_socket(port);
+    if (exporter.signal_fd < 0 || exporter.timer_fd < 0 || exporter.epoll_fd < 0 ||
+        (socket_path[0] != '\0' && exporter.unix_fd < 0) || (port != 0 && exporter.tcp_fd < 0))
+    {
+        perror("Could not set up the exporter");
+        goto cleanup;
+    }
+    if (watch(exporter.epoll_fd, exporter.signal_fd) < 0 || watch(exporter.epoll_fd, exporter.timer_fd) < 0 ||
+        (exporter.unix_fd >= 0 && watch(exporter.epoll_fd, exporter.unix_fd) < 0) ||
+        (exporter.tcp_fd >= 0 && watch(exporter.epoll_fd, exporter.tcp_fd) < 0))
+    {
+        perror("epoll_ctl");
+        goto cleanup;
+    }
+    // Until the daemon is there we serve homedomotics_up 0, and try again on every tick
+    attach(&exporter);
+    if (exporter.reader == NULL)
+        fprintf(stderr, "Sampling daemon not available (%s), retrying every %d ms\n", strerror(errno), TICK_MS);
+    ret = run(&exporter);
+cleanup:
+    while (exporter.nclients > 0)
+        drop_client(&exporter, 0);
+    if (exporter.reader != NULL)
+        detach(&exporter);
+    if (exporter.unix_fd >= 0)
+    {
+        close(exporter.unix_fd);
+        unlink(socket_path);
+    }
+    close(exporter.tcp_fd);
+    close(exporter.epoll_fd);
+    close(exporter.timer_fd);
+    close(exporter.signal_fd);
+    return ret;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/dht11-decode.h"
+
+// Checks include/dht11-decode.h against the per-byte decoder the driver used before it.
+// Built with clang -fsanitize=fuzzer (make libfuzzer) libFuzzer drives it, otherwise main()
+// feeds it random pulses, biased towards the edges: equal lengths, off by one, 0 and UINT32_MAX.
+
+#define BITS_PER_VALUE 8
+#define DEFAULT_ITERATIONS 1000000
+
+struct reference_frame
+{
+    uint8_t value[DHT11_CHECKSUM + 1];
+};
+
+// The driver's old compute_single_value
+static uint8_t reference_single_value(const uint32_t *low_values, const uint32_t *high_values, int offset)
+{
+    uint8_t value = 0;
+    // MSB comes first
+    for (size_t i = 0; i < BITS_PER_VALUE; i++)
+    {
+        // low cycles > high cycles => 0
+        // low cycles < high cycles => 1
+        if (low_values[i + offset] < high_values[i + offset])
+        {
+            value |= 1 << (BITS_PER_VALUE - 1 - i);
+        }
+    }
+    return value;
+}
+static void reference_decode(const uint32_t *low, const uint32_t *high, struct reference_frame *frame)
+{
+    for (int byte = DHT11_HUMIDITY; byte <= DHT11_CHECKSUM; byte++)
+        frame->value[byte] = reference_single_value(low, high, byte * BITS_PER_VALUE);
+}
+// What the sensor does: the low 8 bits of the sum
+static int reference_valid(const struct reference_frame *frame)
+{
+    unsigned int sum = frame->value[DHT11_HUMIDITY] + frame->value[DHT11_HUMIDITY_DECIMAL] +
+                       frame->value[DHT11_TEMPERATURE] + frame->value[DHT11_TEMPERATURE_DECIMAL];
+    return (sum & 0xFF) == frame->value[DHT11_CHECKSUM];
+}
+
+static void check(const uint32_t *low, const uint32_t *high)
+{
+    struct reference_frame expected;
+    uint64_t frame = dht11_decode_frame(low, high);
+    reference_decode(low, high, &expected);
+    if (frame >> DHT11_FRAME_BITS)
+    {
+        fprintf(stderr, "frame %#llx has bits above %d\n", (unsigned long long)frame, DHT11_FRAME_BITS);
+        abort();
+    }
+    for (int byte = DHT11_HUMIDITY; byte <= DHT11_CHECKSUM; byte++)
+    {
+        if (dht11_frame_byte(frame, byte) == expected.value[byte])
+            continue;
+        fprintf(stderr, "byte %d: decoded %u, reference %u\n", byte, dht11_frame_byte(frame, byte),
+                expected.value[byte]);
+        abort();
+    }
+    if (!dht11_frame_valid(frame) != !reference_valid(&expected))
+    {
+        fprintf(stderr, "frame %#llx: valid %d, reference %d\n", (unsigned long long)frame,
+                dht11_frame_valid(frame), reference_valid(&expected));
+        abort();
+    }
+}
+
+// Short inputs are padded with zeroes, so every input is a full set of pulses
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    uint32_t pulses[2 * DHT11_FRAME_BITS];
+    memset(pulses, 0, sizeof(pulses));
+    memcpy(pulses, data, size < sizeof(pulses) ? size : sizeof(pulses));
+    check(pulses, pulses + DHT11_FRAME_BITS);
+    return 0;
+}
+
+#ifndef DHT11_LIBFUZZER
+static uint64_t xorshift(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+static uint32_t random_high(uint64_t *state, uint32_t low)
+{
+    switch (xorshift(state) % 6)
+    {
+    case 0:
+        return low;
+    case 1:
+        return low + 1;
+    case 2:
+        return low - 1;
+    case 3:
+        return 0;
+    case 4:
+        return UINT32_MAX;
+    default:
+        return (uint32_t)xorshift(state);
+    }
+}
+int main(int argc, char *argv[])
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERATIONS;
+    uint64_t state = argc > 2 ? strtoull(argv[2], NULL, 10) : 1;
+    uint32_t low[DHT11_FRAME_BITS], high[DHT11_FRAME_BITS];
+    if (state == 0)
+        state = 1;
+    for (unsigned long i = 0; i < iterations; i++)
+    {
+        for (int bit = 0; bit < DHT11_FRAME_BITS; bit++)
+        {
+            // Pulse counts the driver can see most of the time, anything at all otherwise
+            low[bit] = xorshift(&state) % 4 ? 40 + xorshift(&state) % 20 : (uint32_t)xorshift(&state);
+            high[bit] = random_high(&state, low[bit]);
+        }
+        check(low, high);
+    }
+    printf("%lu frames match the reference decoder\n", iterations);
+    return 0;
+}
+#endif
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "../include/sensor-hub-data.h"
+#include "../include/homedomotics-netlink.h"
+
+// records taken with each read()
+#define BATCH 64
+
+static const char *type_name(__u8 type)
+{
+    switch (type)
+    {
+    case SENSOR_HUB_DHT11:
+        return "dht11";
+    case SENSOR_HUB_MQ135:
+        return "mq135";
+    case SENSOR_HUB_KY004:
+        return "ky004";
+    case SENSOR_HUB_SNAPSHOT:
+        return "snapshot";
+    default:
+        return "unknown";
+    }
+}
+
+static void print_records(const struct sensor_hub_record *records, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct sensor_hub_record *record = &records[i];
+        if (record->version != SENSOR_HUB_RECORD_VERSION)
+            continue;
+        printf("%llu %s[%u]%s%s %d %d %d %d\n", (unsigned long long)record->timestamp,
+               type_name(record->type), record->sensor_id,
+               record->flags & SENSOR_HUB_VALID ? "" : " invalid",
+               record->flags & SENSOR_HUB_OVERRUN ? " overrun" : "",
+               record->value[0], record->value[1], record->value[2], record->value[3]);
+    }
+    fflush(stdout);
+}
+
+// Same records, pushed by the kernel to every subscriber of the samples group
+static int subscribe(void)
+{
+    struct sensor_hub_record records[SENSOR_HUB_GENL_BATCH];
+    struct sensors_netlink *subscriber = sensors_netlink_open();
+    int ret;
+    if (subscriber == NULL)
+    {
+        perror("sensors_netlink_open");
+        return 1;
+    }
+    for (;;)
+    {
+        ret = sensors_netlink_receive(subscriber, records, SENSOR_HUB_GENL_BATCH);
+        if (ret < 0 && errno == ENOBUFS)
+        {
+            fprintf(stderr, "Samples were lost\n");
+            continue;
+        }
+        if (ret < 0)
+            break;
+        print_records(records, ret);
+    }
+    perror("sensors_netlink_receive");
+    sensors_netlink_close(subscriber);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    struct sensor_hub_record records[BATCH];
+    ssize_t ret;
+    int fd;
+
+    if (argc > 1 && strcmp(argv[1], "-n") == 0)
+        return subscribe();
+    fd = open(SENSOR_HUB_DEVICE, O_RDONLY);
+    if (fd < 0)
+    {
+        perror("open");
+        return 1;
+    }
+    // Blocks until something is published, then returns every record queued (up to BATCH)
+    while ((ret = read(fd, records, sizeof(records))) > 0)
+        print_records(records, ret / sizeof(struct sensor_hub_record));
+    if (ret < 0)
+        perror("read");
+    close(fd);
+    return ret < 0;
+}
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include "../include/homedomotics-calibration.h"
+
+// ppm for every COUNT_STEP counts, from 0 to 32768 (the full scale)
+#define COUNT_SHIFT 5
+#define COUNT_STEP (1 << COUNT_SHIFT)
+#define COUNT_MAX 32767
+#define COUNT_ENTRIES ((COUNT_MAX + 1) / COUNT_STEP + 1)
+// Table values are ppm in 1/256. Capped so a difference times a fraction fits in 32 bits
+#define PPM_SHIFT 8
+#define PPM_LIMIT (UINT32_MAX >> COUNT_SHIFT)
+// Compensation every 2.56C from -10.24C and every 5.12%RH from 0, as factors in 1/65536.
+// Steps are powers of two in hundredths, so finding the cell is a shift
+#define TEMPERATURE_SHIFT 8
+#define TEMPERATURE_MIN -1024
+#define TEMPERATURE_CELLS 32
+#define HUMIDITY_SHIFT 9
+#define HUMIDITY_CELLS 20
+#define COMPENSATION_ROW (HUMIDITY_CELLS + 1)
+#define COMPENSATION_SHIFT 16
+
+// Temperature and humidity dependency from the datasheet curves, Rs is divided by it
+#define CORA 0.00035
+#define CORB 0.02718
+#define CORC 1.39538
+#define CORD 0.0018
+#define CORE -0.003333333
+#define CORF -0.001923077
+#define CORG 1.130128205
+
+struct sensors_calibration
+{
+    uint32_t ppm[COUNT_ENTRIES];
+    // One row per temperature. Flat, so the four corners of a cell are a base index plus offsets
+    int32_t compensation[(TEMPERATURE_CELLS + 1) * COMPENSATION_ROW];
+};
+
+static double correction_factor(double temperature, double humidity)
+{
+    if (temperature < 20)
+        return CORA * temperature * temperature - CORB * temperature + CORC - (humidity - 33) * CORD;
+    return CORE * temperature + CORF * humidity + CORG;
+}
+
+// Sensor resistance for count, or a negative value when count is 0V or above the supply
+static double resistance(const SensorsCalibrationConfig *config, double count)
+{
+    double mv = count * config->full_scale_mv / (COUNT_MAX + 1);
+    if (mv <= 0 || mv >= config->supply_mv)
+        return -1;
+    return config->load_ohms * (config->supply_mv - mv) / mv;
+}
+
+static int config_valid(const SensorsCalibrationConfig *config)
+{
+    return config->full_scale_mv > 0 && config->supply_mv > 0 && config->load_ohms > 0 && config->r0_ohms > 0;
+}
+
+struct sensors_calibration *sensors_calibration_alloc(const SensorsCalibrationConfig *config)
+{
+    static const SensorsCalibrationConfig defaults = {
+        .full_scale_mv = SENSORS_CALIBRATION_DEFAULT_FULL_SCALE_MV,
+        .supply_mv = SENSORS_CALIBRATION_DEFAULT_SUPPLY_MV,
+        .load_ohms = SENSORS_CALIBRATION_DEFAULT_LOAD_OHMS,
+        .r0_ohms = SENSORS_CALIBRATION_DEFAULT_R0_OHMS,
+    };
+    struct sensors_calibration *calibration;
+    if (config == NULL)
+        config = &defaults;
+    if (!config_valid(config))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    calibration = malloc(sizeof(struct sensors_calibration));
+    if (calibration == NULL)
+        return NULL;
+    for (unsigned int i = 0; i < COUNT_ENTRIES; i++)
+    {
+        double rs = resistance(config, (double)i * COUNT_STEP), ppm;
+        // 0V is no gas at all, at the supply the resistance is gone and the curve goes to infinity
+        if (rs < 0)
+            ppm = i == 0 ? 0 : HUGE_VAL;
+        else
+            ppm = SENSORS_CALIBRATION_A * pow(rs / config->r0_ohms, SENSORS_CALIBRATION_B);
+        ppm *= 1 << PPM_SHIFT;
+        calibration->ppm[i] = ppm >= PPM_LIMIT ? PPM_LIMIT : (uint32_t)lround(ppm);
+    }
+    // Dividing Rs by the factor multiplies ppm by factor^-b
+    for (unsigned int t = 0; t <= TEMPERATURE_CELLS; t++)
+    {
+        double temperature = (TEMPERATURE_MIN + ((int)t << TEMPERATURE_SHIFT)) / 100.0;
+        for (unsigned int h = 0; h <= HUMIDITY_CELLS; h++)
+        {
+            double humidity = (h << HUMIDITY_SHIFT) / 100.0;
+            double factor = pow(correction_factor(temperature, humidity), -SENSORS_CALIBRATION_B);
+            calibration->compensation[t * COMPENSATION_ROW + h] =
+                (int32_t)lround(factor * (1 << COMPENSATION_SHIFT));
+        }
+    }
+    return calibration;
+}
+
+void sensors_calibration_free(struct sensors_calibration *calibration)
+{
+    free(calibration);
+}
+
+static inline int clamp(int value, int min, int max)
+{
+    value = value < min ? min : value;
+    return value > max ? max : value;
+}
+
+// ppm in 1/256, interpolated between the two table entries around count
+static inline uint32_t lookup_ppm(const uint32_t *table, int count)
+{
+    uint32_t clamped = (uint32_t)clamp(count, 0, COUNT_MAX);
+    uint32_t index = clamped >> COUNT_SHIFT, fraction = clamped & (COUNT_STEP - 1);
+    // The curve only goes up, the difference is never negative
+    return table[index] + (((table[index + 1] - table[index]) * fraction) >> COUNT_SHIFT);
+}
+
+void sensors_calibration_ppm(const struct sensors_calibration *calibration, const int *restrict counts,
+                             float *restrict ppm, size_t n)
+{
+    const uint32_t *table = calibration->ppm;
+    for (size_t i = 0; i < n; i++)
+        ppm[i] = (float)lookup_ppm(table, counts[i]) * (1.0f / (1 << PPM_SHIFT));
+}
+
+void sensors_calibration_ppm_compensated(const struct sensors_calibration *calibration, const int *restrict counts,
+                                         const int *restrict temperature, const int *restrict humidity,
+                                         float *restrict ppm, size_t n)
+{
+    const int temperature_span = (TEMPERATURE_CELLS << TEMPERATURE_SHIFT) - 1;
+    const int humidity_span = (HUMIDITY_CELLS << HUMIDITY_SHIFT) - 1;
+    const uint32_t *table = calibration->ppm;
+    const int32_t *compensation = calibration->compensation;
+    for (size_t i = 0; i < n; i++)
+    {
+        // Bilinear interpolation in the cell around (temperature, humidity)
+        int t = clamp(temperature[i] - TEMPERATURE_MIN, 0, temperature_span);
+        int h = clamp(humidity[i], 0, humidity_span);
+        int t_fraction = t & ((1 << TEMPERATURE_SHIFT) - 1), h_fraction = h & ((1 << HUMIDITY_SHIFT) - 1);
+        int cell = (t >> TEMPERATURE_SHIFT) * COMPENSATION_ROW + (h >> HUMIDITY_SHIFT);
+        int32_t low = compensation[cell], low_next = compensation[cell + 1];
+        int32_t high = compensation[cell + COMPENSATION_ROW], high_next = compensation[cell + COMPENSATION_ROW + 1];
+        int32_t low_factor = low + (((low_next - low) * h_fraction) >> HUMIDITY_SHIFT);
+        int32_t high_factor = high + (((high_next - high) * h_fraction) >> HUMIDITY_SHIFT);
+        int32_t factor = low_factor + (((high_factor - low_factor) * t_fraction) >> TEMPERATURE_SHIFT);
+        // The product needs more than 32 bits, it is done in float
+        ppm[i] = (float)lookup_ppm(table, counts[i]) * (float)factor *
+                 (1.0f / ((float)(1 << PPM_SHIFT) * (float)(1 << COMPENSATION_SHIFT)));
+    }
+}
+
+double sensors_calibration_r0(const SensorsCalibrationConfig *config, int count, int temperature, int humidity)
+{
+    double rs;
+    if (config == NULL || config->full_scale_mv == 0 || config->supply_mv == 0 || config->load_ohms == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    rs = resistance(config, count);
+    if (rs < 0)
+        return -1;
+    rs /= correction_factor(temperature / 100.0, humidity / 100.0);
+    // ppm = a * (rs / r0)^b solved for r0
+    return rs / pow(SENSORS_CALIBRATION_ATMOSPHERIC_PPM / SENSORS_CALIBRATION_A, 1 / SENSORS_CALIBRATION_B);
+}
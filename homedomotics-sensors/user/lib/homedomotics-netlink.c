@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/genetlink.h>
+#include "../include/homedomotics-netlink.h"
+
+// Large enough for a full batch and for the family description
+#define BUFFER_SIZE 8192
+
+struct sensors_netlink
+{
+    int fd;
+    __u16 family;
+    __u32 group;
+    char buffer[BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+};
+
+#define ATTRIBUTE_DATA(attribute) ((void *)((char *)(attribute) + NLA_HDRLEN))
+#define ATTRIBUTE_LENGTH(attribute) ((int)(attribute)->nla_len - NLA_HDRLEN)
+#define FOR_EACH_ATTRIBUTE(attribute, start, length)                                                          \
+    for (struct nlattr *attribute = (struct nlattr *)(start); (length) >= (int)NLA_HDRLEN &&                  \
+                                                              attribute->nla_len >= NLA_HDRLEN &&             \
+                                                              attribute->nla_len <= (length);                 \
+         (length) -= NLA_ALIGN(attribute->nla_len),                                                           \
+                        attribute = (struct nlattr *)((char *)attribute + NLA_ALIGN(attribute->nla_len)))
+
+// Looks for the id of the samples group in CTRL_ATTR_MCAST_GROUPS
+static int find_group(struct nlattr *groups, __u32 *group)
+{
+    int length = ATTRIBUTE_LENGTH(groups);
+    FOR_EACH_ATTRIBUTE(entry, ATTRIBUTE_DATA(groups), length)
+    {
+        int entry_length = ATTRIBUTE_LENGTH(entry);
+        const char *name = NULL;
+        __u32 id = 0;
+        int has_id = 0;
+        FOR_EACH_ATTRIBUTE(field, ATTRIBUTE_DATA(entry), entry_length)
+        {
+            if ((field->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GRP_NAME)
+                name = ATTRIBUTE_DATA(field);
+            else if ((field->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GRP_ID)
+            {
+                memcpy(&id, ATTRIBUTE_DATA(field), sizeof(id));
+                has_id = 1;
+            }
+        }
+        if (name != NULL && has_id && strcmp(name, SENSOR_HUB_GENL_GROUP) == 0)
+        {
+            *group = id;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Asks the generic netlink controller for the family and group ids the kernel gave us
+static int resolve_family(struct sensors_netlink *subscriber)
+{
+    struct
+    {
+        struct nlmsghdr header;
+        struct genlmsghdr genl;
+        char attributes[NLA_HDRLEN + NLA_ALIGN(sizeof(SENSOR_HUB_GENL_NAME))];
+    } request;
+    struct nlattr *name = (struct nlattr *)request.attributes;
+    struct nlmsghdr *reply = (struct nlmsghdr *)subscriber->buffer;
+    struct genlmsghdr *genl;
+    int received, length, has_family = 0, has_group = 0;
+    memset(&request, 0, sizeof(request));
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = GENL_ID_CTRL;
+    request.header.nlmsg_flags = NLM_F_REQUEST;
+    request.genl.cmd = CTRL_CMD_GETFAMILY;
+    request.genl.version = 1;
+    name->nla_type = CTRL_ATTR_FAMILY_NAME;
+    name->nla_len = NLA_HDRLEN + sizeof(SENSOR_HUB_GENL_NAME);
+    memcpy(ATTRIBUTE_DATA(name), SENSOR_HUB_GENL_NAME, sizeof(SENSOR_HUB_GENL_NAME));
+    if (send(subscriber->fd, &request, sizeof(request), 0) < 0)
+        return -1;
+    received = recv(subscriber->fd, subscriber->buffer, BUFFER_SIZE, 0);
+    if (received < 0)
+        return -1;
+    if (!NLMSG_OK(reply, (unsigned int)received))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    if (reply->nlmsg_type == NLMSG_ERROR)
+    {
+        struct nlmsgerr *error = NLMSG_DATA(reply);
+        errno = error->error ? -error->error : ENOENT;
+        return -1;
+    }
+    genl = NLMSG_DATA(reply);
+    length = reply->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    FOR_EACH_ATTRIBUTE(attribute, (char *)genl + GENL_HDRLEN, length)
+    {
+        if ((attribute->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_FAMILY_ID)
+        {
+            memcpy(&subscriber->family, ATTRIBUTE_DATA(attribute), sizeof(subscriber->family));
+            has_family = 1;
+        }
+        else if ((attribute->nla_type & NLA_TYPE_MASK) == CTRL_ATTR_MCAST_GROUPS)
+            has_group = find_group(attribute, &subscriber->group) == 0;
+    }
+    if (!has_family || !has_group)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    return 0;
+}
+
+struct sensors_netlink *sensors_netlink_open(void)
+{
+    struct sockaddr_nl address = {.nl_family = AF_NETLINK};
+    struct sensors_netlink *subscriber = calloc(1, sizeof(struct sensors_netlink));
+    int error;
+    if (subscriber == NULL)
+        return NULL;
+    subscriber->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (subscriber->fd < 0)
+        goto free_subscriber;
+    if (bind(subscriber->fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        goto close_socket;
+    if (resolve_family(subscriber) < 0)
+        goto close_socket;
+    if (setsockopt(subscriber->fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP, &subscriber->group,
+                   sizeof(subscriber->group)) < 0)
+        goto close_socket;
+    return subscriber;
+close_socket:
+    error = errno;
+    close(subscriber->fd);
+    errno = error;
+free_subscriber:
+    free(subscriber);
+    return NULL;
+}
+
+int sensors_netlink_fd(struct sensors_netlink *subscriber)
+{
+    return subscriber->fd;
+}
+
+int sensors_netlink_receive(struct sensors_netlink *subscriber, struct sensor_hub_record *records, size_t max)
+{
+    struct nlmsghdr *message = (struct nlmsghdr *)subscriber->buffer;
+    size_t copied = 0;
+    int received;
+    do
+        received = recv(subscriber->fd, subscriber->buffer, BUFFER_SIZE, 0);
+    while (received < 0 && errno == EINTR);
+    if (received < 0)
+        return -1;
+    for (unsigned int left = received; NLMSG_OK(message, left); message = NLMSG_NEXT(message, left))
+    {
+        int length;
+        // Replies to the family lookup or anything else sharing the socket
+        if (message->nlmsg_type != subscriber->family)
+            continue;
+        length = message->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+        FOR_EACH_ATTRIBUTE(attribute, (char *)NLMSG_DATA(message) + GENL_HDRLEN, length)
+        {
+            if (attribute->nla_type != SENSOR_HUB_ATTR_RECORD ||
+                ATTRIBUTE_LENGTH(attribute) != sizeof(struct sensor_hub_record) || copied == max)
+                continue;
+            memcpy(&records[copied++], ATTRIBUTE_DATA(attribute), sizeof(struct sensor_hub_record));
+        }
+    }
+    return (int)copied;
+}
+
+void sensors_netlink_close(struct sensors_netlink *subscriber)
+{
+    if (subscriber == NULL)
+        return;
+    close(subscriber->fd);
+    free(subscriber);
+}
@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "../include/homedomotics-recording.h"
+
+// Events are written as they are in memory, recordings are only meant to be replayed on a
+// machine of the same kind. event_size catches the ones that aren't
+struct sensors_recording_header
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int event_size;
+    unsigned int reserved;
+};
+
+struct sensors_recording
+{
+    FILE *file;
+};
+
+static struct sensors_recording *recording_alloc(const char *path, const char *mode)
+{
+    struct sensors_recording *recording = malloc(sizeof(struct sensors_recording));
+    if (recording == NULL)
+        return NULL;
+    recording->file = fopen(path, mode);
+    if (recording->file == NULL)
+    {
+        free(recording);
+        return NULL;
+    }
+    return recording;
+}
+
+struct sensors_recording *sensors_recording_create(const char *path)
+{
+    struct sensors_recording_header header = {
+        .magic = SENSORS_RECORDING_MAGIC,
+        .version = SENSORS_RECORDING_VERSION,
+        .event_size = sizeof(SensorsEvent),
+    };
+    struct sensors_recording *recording = recording_alloc(path, "wbe");
+    if (recording == NULL)
+        return NULL;
+    if (fwrite(&header, sizeof(header), 1, recording->file) != 1)
+    {
+        sensors_recording_close(recording);
+        return NULL;
+    }
+    return recording;
+}
+
+struct sensors_recording *sensors_recording_open(const char *path)
+{
+    struct sensors_recording_header header;
+    struct sensors_recording *recording = recording_alloc(path, "rbe");
+    if (recording == NULL)
+        return NULL;
+    if (fread(&header, sizeof(header), 1, recording->file) != 1 || header.magic != SENSORS_RECORDING_MAGIC ||
+        header.version != SENSORS_RECORDING_VERSION || header.event_size != sizeof(SensorsEvent))
+    {
+        sensors_recording_close(recording);
+        errno = EINVAL;
+        return NULL;
+    }
+    return recording;
+}
+
+int sensors_recording_write(struct sensors_recording *recording, const SensorsEvent *event)
+{
+    return fwrite(event, sizeof(SensorsEvent), 1, recording->file) == 1 ? 0 : -1;
+}
+
+int sensors_recording_read(struct sensors_recording *recording, SensorsEvent *event)
+{
+    if (fread(event, sizeof(SensorsEvent), 1, recording->file) == 1)
+        return 1;
+    // A recorder killed halfway through an event leaves a partial one at the end
+    return ferror(recording->file) ? -1 : 0;
+}
+
+int sensors_recording_rewind(struct sensors_recording *recording)
+{
+    return fseek(recording->file, sizeof(struct sensors_recording_header), SEEK_SET);
+}
+
+int sensors_recording_close(struct sensors_recording *recording)
+{
+    int ret;
+    if (recording == NULL)
+        return 0;
+    ret = fclose(recording->file) == 0 ? 0 : -1;
+    free(recording);
+    return ret;
+}
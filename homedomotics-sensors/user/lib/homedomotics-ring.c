@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../include/homedomotics-ring.h"
+
+struct sensors_ring_reader
+{
+    const struct sensors_ring_memory *memory;
+    int socket_fd;
+    int event_fd;
+    // next record number we want
+    uint64_t next;
+    uint64_t dropped;
+};
+
+// The daemon answers the connection with one message carrying the ring memfd and our eventfd
+static int receive_fds(int socket_fd, int *ring_fd, int *event_fd)
+{
+    char byte;
+    struct iovec iov = {.iov_base = &byte, .iov_len = 1};
+    union
+    {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    struct cmsghdr *cmsg;
+    int fds[2];
+    if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) <= 0)
+        return -1;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+    {
+        errno = EPROTO;
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    *ring_fd = fds[0];
+    *event_fd = fds[1];
+    return 0;
+}
+
+struct sensors_ring_reader *sensors_ring_attach(const char *socket_path)
+{
+    struct sensors_ring_reader *reader;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    void *memory;
+    int ring_fd;
+    int error;
+    if (socket_path == NULL)
+        socket_path = SENSORS_RING_SOCKET;
+    if (strlen(socket_path) >= sizeof(address.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(address.sun_path, socket_path);
+    reader = calloc(1, sizeof(struct sensors_ring_reader));
+    if (reader == NULL)
+        return NULL;
+    reader->socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (reader->socket_fd < 0)
+        goto free_reader;
+    if (connect(reader->socket_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+        goto close_socket;
+    if (receive_fds(reader->socket_fd, &ring_fd, &reader->event_fd) < 0)
+        goto close_socket;
+    // We only read, so the daemon is the only one who can ever dirty these pages
+    memory = mmap(NULL, sizeof(struct sensors_ring_memory), PROT_READ, MAP_SHARED, ring_fd, 0);
+    error = errno;
+    close(ring_fd);
+    if (memory == MAP_FAILED)
+    {
+        errno = error;
+        goto close_event;
+    }
+    reader->memory = memory;
+    if (reader->memory->header.magic != SENSORS_RING_MAGIC ||
+        reader->memory->header.version != SENSORS_RING_VERSION ||
+        reader->memory->header.slots != SENSORS_RING_SLOTS ||
+        reader->memory->header.record_size != sizeof(SensorsRecord))
+    {
+        errno = EPROTO;
+        goto unmap;
+    }
+    // Start with what is published from now on
+    reader->next = atomic_load_explicit((_Atomic uint64_t *)&reader->memory->header.head, memory_order_acquire);
+    return reader;
+unmap:
+    munmap(memory, sizeof(struct sensors_ring_memory));
+close_event:
+    close(reader->event_fd);
+close_socket:
+    error = errno;
+    close(reader->socket_fd);
+    errno = error;
+free_reader:
+    free(reader);
+    return NULL;
+}
+
+size_t sensors_ring_read(struct sensors_ring_reader *reader, SensorsRecord *records, size_t max)
+{
+    const struct sensors_ring_memory *memory = reader->memory;
+    size_t copied = 0;
+    uint64_t head = atomic_load_explicit((_Atomic uint64_t *)&memory->header.head, memory_order_acquire);
+    while (copied < max && reader->next < head)
+    {
+        const struct sensors_ring_slot *slot;
+        uint64_t expected;
+        uint64_t before;
+        uint64_t after;
+        // Everything older than head - SLOTS has been overwritten already
+        if (head - reader->next > SENSORS_RING_SLOTS)
+        {
+            reader->dropped += head - SENSORS_RING_SLOTS - reader->next;
+            reader->next = head - SENSORS_RING_SLOTS;
+        }
+        slot = &memory->slots[reader->next % SENSORS_RING_SLOTS];
+        expected = 2 * (reader->next + 1);
+        before = atomic_load_explicit((_Atomic uint64_t *)&slot->sequence, memory_order_acquire);
+        memcpy(&records[copied], &slot->record, sizeof(SensorsRecord));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit((_Atomic uint64_t *)&slot->sequence, memory_order_relaxed);
+        if (before != expected || after != expected)
+        {
+            // The writer lapped us while we were copying, catch up with the new head
+            head = atomic_load_explicit((_Atomic uint64_t *)&memory->header.head, memory_order_acquire);
+            if (head - reader->next <= SENSORS_RING_SLOTS)
+            {
+                reader->dropped++;
+                reader->next++;
+            }
+            continue;
+        }
+        copied++;
+        reader->next++;
+    }
+    return copied;
+}
+
+static void clear_event(struct sensors_ring_reader *reader)
+{
+    uint64_t count;
+    // The daemon made it non-blocking, so this fails with EAGAIN when nothing is pending
+    if (read(reader->event_fd, &count, sizeof(count)) < 0)
+        return;
+}
+
+int sensors_ring_wait(struct sensors_ring_reader *reader, int timeout_ms)
+{
+    // The socket only becomes readable when the daemon goes away
+    struct pollfd fds[2] = {
+        {.fd = reader->event_fd, .events = POLLIN},
+        {.fd = reader->socket_fd, .events = POLLIN},
+    };
+    int ready;
+    // The eventfd only tells about new records, some may be waiting already
+    if (reader->next < atomic_load_explicit((_Atomic uint64_t *)&reader->memory->header.head,
+                                            memory_order_acquire))
+    {
+        clear_event(reader);
+        return 1;
+    }
+    ready = poll(fds, 2, timeout_ms);
+    if (ready <= 0)
+        return ready;
+    if (fds[1].revents)
+    {
+        errno = EPIPE;
+        return -1;
+    }
+    clear_event(reader);
+    return 1;
+}
+
+int sensors_ring_fd(struct sensors_ring_reader *reader)
+{
+    return reader->event_fd;
+}
+
+uint64_t sensors_ring_dropped(struct sensors_ring_reader *reader)
+{
+    return reader->dropped;
+}
+
+void sensors_ring_detach(struct sensors_ring_reader *reader)
+{
+    if (reader == NULL)
+        return;
+    munmap((void *)reader->memory, sizeof(struct sensors_ring_memory));
+    close(reader->event_fd);
+    close(reader->socket_fd);
+    free(reader);
+}
@@ -0,0 +1,253 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "../include/homedomotics-rollup.h"
+
+#define NS_PER_SECOND 1000000000ULL
+#define BINS 128
+
+struct tier_config
+{
+    unsigned long long width;
+    unsigned int slots;
+};
+static const struct tier_config tier_configs[SENSORS_ROLLUP_TIERS] = {
+    [SENSORS_ROLLUP_MINUTE] = {60 * NS_PER_SECOND, 24 * 60},
+    [SENSORS_ROLLUP_HOUR] = {60 * 60 * NS_PER_SECOND, 30 * 24},
+    [SENSORS_ROLLUP_DAY] = {24 * 60 * 60 * NS_PER_SECOND, 365},
+};
+// Histogram bins start at 0 and are this wide, values past the last bin go into it.
+// They cover 0-51.2C, 0-102.4% and the positive half of the ADS1115 range
+static const int bin_widths[SENSORS_ROLLUP_FIELDS] = {
+    [SENSORS_ROLLUP_TEMPERATURE] = 40,
+    [SENSORS_ROLLUP_HUMIDITY] = 80,
+    [SENSORS_ROLLUP_AIR_QUALITY] = 256,
+};
+
+struct field_summary
+{
+    uint64_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    uint32_t bins[BINS];
+};
+struct bucket
+{
+    // bucket number + 1, 0 while the slot was never used
+    uint64_t index;
+    struct field_summary fields[SENSORS_ROLLUP_FIELDS];
+};
+struct tier
+{
+    // newest bucket number + 1
+    uint64_t newest;
+    struct bucket *buckets;
+};
+struct sensors_rollup
+{
+    struct tier tiers[SENSORS_ROLLUP_TIERS];
+};
+// Several buckets added up, bins are wider so a year of samples can't overflow them
+struct merged_summary
+{
+    uint64_t count;
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    uint64_t bins[BINS];
+};
+
+struct sensors_rollup *sensors_rollup_alloc(void)
+{
+    struct sensors_rollup *rollup = calloc(1, sizeof(struct sensors_rollup));
+    if (rollup == NULL)
+        return NULL;
+    for (int tier = 0; tier < SENSORS_ROLLUP_TIERS; tier++)
+    {
+        rollup->tiers[tier].buckets = calloc(tier_configs[tier].slots, sizeof(struct bucket));
+        if (rollup->tiers[tier].buckets == NULL)
+        {
+            sensors_rollup_free(rollup);
+            return NULL;
+        }
+    }
+    return rollup;
+}
+void sensors_rollup_free(struct sensors_rollup *rollup)
+{
+    if (rollup == NULL)
+        return;
+    for (int tier = 0; tier < SENSORS_ROLLUP_TIERS; tier++)
+        free(rollup->tiers[tier].buckets);
+    free(rollup);
+}
+
+static unsigned int bin_of(int field, int value)
+{
+    int bin = value / bin_widths[field];
+    if (bin < 0)
+        return 0;
+    return bin >= BINS ? BINS - 1 : (unsigned int)bin;
+}
+static void add_value(struct field_summary *summary, int field, int value)
+{
+    if (summary->count == 0 || value < summary->min)
+        summary->min = value;
+    if (summary->count == 0 || value > summary->max)
+        summary->max = value;
+    summary->count++;
+    summary->sum += value;
+    summary->bins[bin_of(field, value)]++;
+}
+// Returns NULL when the sample is too old for the tier
+static struct bucket *bucket_for(struct sensors_rollup *rollup, int tier, unsigned long long timestamp)
+{
+    const struct tier_config *config = &tier_configs[tier];
+    uint64_t index = timestamp / config->width + 1;
+    uint64_t newest = rollup->tiers[tier].newest;
+    struct bucket *bucket = &rollup->tiers[tier].buckets[index % config->slots];
+    if (bucket->index == index)
+        return bucket;
+    if (bucket->index > index || (newest > config->slots && index <= newest - config->slots))
+        return NULL;
+    // The slot still holds a bucket from a previous lap around the ring
+    memset(bucket, 0, sizeof(struct bucket));
+    bucket->index = index;
+    if (index > newest)
+        rollup->tiers[tier].newest = index;
+    return bucket;
+}
+
+void sensors_rollup_add(struct sensors_rollup *rollup, const SensorsSamples *samples)
+{
+    for (size_t i = 0; i < samples->count; i++)
+    {
+        for (int tier = 0; tier < SENSORS_ROLLUP_TIERS; tier++)
+        {
+            struct bucket *bucket = bucket_for(rollup, tier, samples->timestamp[i]);
+            if (bucket == NULL)
+                continue;
+            if (samples->valid[i] & SAMPLE_TEMPERATURE_HUMIDITY_VALID)
+            {
+                add_value(&bucket->fields[SENSORS_ROLLUP_TEMPERATURE], SENSORS_ROLLUP_TEMPERATURE,
+                          samples->temperature[i]);
+                add_value(&bucket->fields[SENSORS_ROLLUP_HUMIDITY], SENSORS_ROLLUP_HUMIDITY, samples->humidity[i]);
+            }
+            if (samples->valid[i] & SAMPLE_AIR_QUALITY_VALID)
+                add_value(&bucket->fields[SENSORS_ROLLUP_AIR_QUALITY], SENSORS_ROLLUP_AIR_QUALITY,
+                          samples->air_quality[i]);
+        }
+    }
+}
+
+static void merge(struct merged_summary *merged, const struct field_summary *summary)
+{
+    if (summary->count == 0)
+        return;
+    if (merged->count == 0 || summary->min < merged->min)
+        merged->min = summary->min;
+    if (merged->count == 0 || summary->max > merged->max)
+        merged->max = summary->max;
+    merged->count += summary->count;
+    merged->sum += summary->sum;
+    for (int bin = 0; bin < BINS; bin++)
+        merged->bins[bin] += summary->bins[bin];
+}
+// Interpolates inside the bin holding the rank, and never goes past the values actually seen
+static int percentile(const struct merged_summary *merged, int field, double q)
+{
+    uint64_t rank = (uint64_t)(q * merged->count + 0.5);
+    uint64_t seen = 0;
+    int value = merged->max;
+    if (rank == 0)
+        rank = 1;
+    for (int bin = 0; bin < BINS; bin++)
+    {
+        if (seen + merged->bins[bin] >= rank)
+        {
+            double inside = (double)(rank - seen) / merged->bins[bin];
+            value = (int)(bin_widths[field] * (bin + inside));
+            break;
+        }
+        seen += merged->bins[bin];
+    }
+    if (value < merged->min)
+        return merged->min;
+    return value > merged->max ? merged->max : value;
+}
+static void fill_aggregate(const struct merged_summary *merged, int field, unsigned long long start,
+                           SensorsAggregate *aggregate)
+{
+    aggregate->start = start;
+    aggregate->count = merged->count;
+    aggregate->min = merged->min;
+    aggregate->max = merged->max;
+    aggregate->mean = (double)merged->sum / merged->count;
+    aggregate->p50 = percentile(merged, field, 0.50);
+    aggregate->p90 = percentile(merged, field, 0.90);
+    aggregate->p99 = percentile(merged, field, 0.99);
+}
+// Bucket numbers (+ 1) starting in [from, to] that the ring still holds, returns 0 when there are none
+static int bucket_range(struct sensors_rollup *rollup, int tier, unsigned long long from, unsigned long long to,
+                        uint64_t *first, uint64_t *last)
+{
+    const struct tier_config *config = &tier_configs[tier];
+    uint64_t newest = rollup->tiers[tier].newest;
+    if (newest == 0 || from > to)
+        return 0;
+    *first = from / config->width + (from % config->width != 0) + 1;
+    *last = to / config->width + 1;
+    if (*last > newest)
+        *last = newest;
+    if (newest > config->slots && *first <= newest - config->slots)
+        *first = newest - config->slots + 1;
+    return *first <= *last;
+}
+
+int sensors_rollup_query(struct sensors_rollup *rollup, enum sensors_rollup_tier tier,
+                         enum sensors_rollup_field field, unsigned long long from, unsigned long long to,
+                         SensorsAggregate *aggregate)
+{
+    const struct tier_config *config = &tier_configs[tier];
+    struct merged_summary merged;
+    uint64_t first, last, start = 0;
+    memset(&merged, 0, sizeof(merged));
+    if (!bucket_range(rollup, tier, from, to, &first, &last))
+        return -1;
+    for (uint64_t index = first; index <= last; index++)
+    {
+        const struct bucket *bucket = &rollup->tiers[tier].buckets[index % config->slots];
+        if (bucket->index != index || bucket->fields[field].count == 0)
+            continue;
+        if (merged.count == 0)
+            start = (index - 1) * config->width;
+        merge(&merged, &bucket->fields[field]);
+    }
+    if (merged.count == 0)
+        return -1;
+    fill_aggregate(&merged, field, start, aggregate);
+    return 0;
+}
+
+size_t sensors_rollup_series(struct sensors_rollup *rollup, enum sensors_rollup_tier tier,
+                             enum sensors_rollup_field field, unsigned long long from, unsigned long long to,
+                             SensorsAggregate *aggregates, size_t max)
+{
+    const struct tier_config *config = &tier_configs[tier];
+    struct merged_summary merged;
+    uint64_t first, last;
+    size_t written = 0;
+    if (!bucket_range(rollup, tier, from, to, &first, &last))
+        return 0;
+    for (uint64_t index = first; index <= last && written < max; index++)
+    {
+        const struct bucket *bucket = &rollup->tiers[tier].buckets[index % config->slots];
+        if (bucket->index != index || bucket->fields[field].count == 0)
+            continue;
+        memset(&merged, 0, sizeof(merged));
+        merge(&merged, &bucket->fields[field]);
+        fill_aggregate(&merged, field, (index - 1) * config->width, &aggregates[written++]);
+    }
+    return written;
+}
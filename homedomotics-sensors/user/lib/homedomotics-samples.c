@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "../include/homedomotics-samples.h"
+#include "../include/homedomotics-uring.h"
+#include "../include/dht11-decode.h"
+
+// Records are converted in chunks so the columns are written in tight loops
+#define CONVERSION_CHUNK 256
+
+SensorsSamples *sensors_samples_alloc(size_t capacity)
+{
+    SensorsSamples *samples;
+    char *columns;
+    // timestamps go first so every column stays aligned
+    size_t size = capacity * (sizeof(unsigned long long) + 3 * sizeof(int) + sizeof(unsigned char));
+    samples = malloc(sizeof(SensorsSamples));
+    if (samples == NULL)
+        return NULL;
+    columns = malloc(size > 0 ? size : 1);
+    if (columns == NULL)
+    {
+        free(samples);
+        return NULL;
+    }
+    samples->count = 0;
+    samples->capacity = capacity;
+    samples->timestamp = (unsigned long long *)columns;
+    samples->temperature = (int *)(samples->timestamp + capacity);
+    samples->humidity = samples->temperature + capacity;
+    samples->air_quality = samples->humidity + capacity;
+    samples->valid = (unsigned char *)(samples->air_quality + capacity);
+    return samples;
+}
+void sensors_samples_free(SensorsSamples *samples)
+{
+    if (samples == NULL)
+        return;
+    free(samples->timestamp);
+    free(samples);
+}
+static void convert_chunk(SensorsSamples *samples, const SensorsRecord *records, size_t n)
+{
+    size_t base = samples->count;
+    unsigned long long *timestamp = samples->timestamp + base;
+    int *temperature = samples->temperature + base;
+    int *humidity = samples->humidity + base;
+    int *air_quality = samples->air_quality + base;
+    unsigned char *valid = samples->valid + base;
+    // One loop per column, without branches, so the compiler can vectorise them
+    for (size_t i = 0; i < n; i++)
+        timestamp[i] = records[i].timestamp;
+    for (size_t i = 0; i < n; i++)
+        temperature[i] = dht11_to_hundredths(records[i].temperature_humidity.temperature,
+                                             records[i].temperature_humidity.temperature_decimal);
+    for (size_t i = 0; i < n; i++)
+        humidity[i] = dht11_to_hundredths(records[i].temperature_humidity.humidity,
+                                          records[i].temperature_humidity.humidity_decimal);
+    for (size_t i = 0; i < n; i++)
+        air_quality[i] = records[i].air_quality.air_quality;
+    for (size_t i = 0; i < n; i++)
+        valid[i] = (records[i].temperature_humidity.successful != 0) * SAMPLE_TEMPERATURE_HUMIDITY_VALID |
+                   (records[i].air_quality.read_data != 0) * SAMPLE_AIR_QUALITY_VALID;
+    samples->count += n;
+}
+size_t sensors_samples_append(SensorsSamples *samples, const SensorsRecord *records, size_t n)
+{
+    size_t free_slots = samples->capacity - samples->count;
+    if (n > free_slots)
+        n = free_slots;
+    for (size_t done = 0; done < n; done += CONVERSION_CHUNK)
+        convert_chunk(samples, records + done, n - done < CONVERSION_CHUNK ? n - done : CONVERSION_CHUNK);
+    return n;
+}
+// Without io_uring (old kernels, seccomp) the devices are read one after the other, from fds
+// opened once for the whole batch
+struct batch_reader
+{
+    struct sensors_uring *ring;
+    int dht11_fd;
+    int mq135_fd;
+};
+static int batch_open(struct batch_reader *reader)
+{
+    reader->dht11_fd = -1;
+    reader->mq135_fd = -1;
+    reader->ring = sensors_uring_open(0);
+    if (reader->ring != NULL)
+        return 0;
+    reader->dht11_fd = open(DHT11_CHAR_DEVICE, O_RDONLY);
+    reader->mq135_fd = open(MQ135_DEVICE, O_RDONLY);
+    return reader->dht11_fd < 0 || reader->mq135_fd < 0 ? -1 : 0;
+}
+static int batch_read(struct batch_reader *reader, SensorsRecord *record)
+{
+    struct timespec now;
+    if (reader->ring != NULL)
+        return sensors_uring_collect(reader->ring, record, NULL) < 0 ? -1 : 0;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->timestamp = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    // drivers return 0 on success, so we only check for errors
+    if (read(reader->dht11_fd, &record->temperature_humidity, sizeof(struct dht11_measurement)) < 0)
+        return -1;
+    return read(reader->mq135_fd, &record->air_quality, sizeof(struct mq135_measurement)) < 0 ? -1 : 0;
+}
+static void batch_close(struct batch_reader *reader)
+{
+    sensors_uring_close(reader->ring);
+    if (reader->dht11_fd >= 0)
+        close(reader->dht11_fd);
+    if (reader->mq135_fd >= 0)
+        close(reader->mq135_fd);
+}
+size_t sensors_samples_read(SensorsSamples *samples, size_t count, unsigned int period_ms)
+{
+    SensorsRecord chunk[CONVERSION_CHUNK];
+    struct batch_reader reader;
+    struct timespec deadline;
+    size_t read = 0, pending = 0;
+    if (count > samples->capacity - samples->count)
+        count = samples->capacity - samples->count;
+    if (count == 0)
+        return 0;
+    if (batch_open(&reader) < 0)
+    {
+        batch_close(&reader);
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (read < count)
+    {
+        if (batch_read(&reader, &chunk[pending]) < 0)
+            break;
+        read++;
+        if (++pending == CONVERSION_CHUNK)
+        {
+            convert_chunk(samples, chunk, pending);
+            pending = 0;
+        }
+        if (read == count || period_ms == 0)
+            continue;
+        // Keep a fixed rate no matter how long each read took
+        deadline.tv_sec += period_ms / 1000;
+        deadline.tv_nsec += (long)(period_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+    if (pending > 0)
+        convert_chunk(samples, chunk, pending);
+    batch_close(&reader);
+    return read;
+}
@@ -1,21 +1,47 @@
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/select.h>
 #include "../include/homedomotics-sensors.h"
 
+struct air_quality_job
+{
+    AirQuality measurement;
+    int ret;
+};
+
+static int read_device(const char *device, void *measurement, size_t size)
+{
+    int fd, ret;
+    if ((fd = open(device, O_RDONLY)) < 0)
+        return -1;
+    // drivers return 0 on success, so we only check for errors
+    ret = read(fd, measurement, size);
+    close(fd);
+    return ret < 0 ? -1 : 0;
+}
+static void *air_quality_worker(void *arg)
+{
+    struct air_quality_job *job = arg;
+    job->ret = read_device(MQ135_DEVICE, &job->measurement, sizeof(struct mq135_measurement));
+    return NULL;
+}
+
 int wait_to_read(void)
 {
     int fd, ret;
     fd_set readfs;
 
     fd = open(KY004_DEVICE, O_RDONLY);
-    if (fd < -1)
+    if (fd < 0)
         return 1;
     FD_ZERO(&readfs);
     FD_SET(fd, &readfs);
     ret = select(fd + 1, &readfs, NULL, NULL, NULL);
+    close(fd);
     if (ret == -1)
     {
         return 0;
@@ -27,10 +53,11 @@ AirQuality *read_air_quality(void)
     AirQuality *measurement = malloc(sizeof(AirQuality));
     if (measurement == NULL)
         return NULL;
-    int fd = 0;
-    if ((fd = open(MQ135_DEVICE, O_RDONLY)) < -1)
+    if (read_device(MQ135_DEVICE, measurement, sizeof(struct mq135_measurement)) < 0)
+    {
+        free(measurement);
         return NULL;
-    read(fd, &measurement, sizeof(struct mq135_measurement));
+    }
     return measurement;
 }
 TemperatureHumidity *read_temperature_humidity(void)
@@ -38,9 +65,43 @@ TemperatureHumidity *read_temperature_humidity(void)
     TemperatureHumidity *measurement = malloc(sizeof(TemperatureHumidity));
     if (measurement == NULL)
         return NULL;
-    int fd = 0;
-    if ((fd = open(DHT11_CHAR_DEVICE, O_RDONLY)) < -1)
+    if (read_device(DHT11_CHAR_DEVICE, measurement, sizeof(struct dht11_measurement)) < 0)
+    {
+        free(measurement);
         return NULL;
-    read(fd, measurement, sizeof(struct dht11_measurement));
+    }
     return measurement;
-}
\ No newline at end of file
+}
+int read_all_into(SensorsRecord *record)
+{
+    pthread_t worker;
+    struct timespec now;
+    struct air_quality_job job = {.ret = -1};
+    int worker_started, ret;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->timestamp = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    // The ADS1115 conversion runs on its own thread while we go through the DHT11
+    // handshake on this one, so we only wait for the slower of the two
+    worker_started = pthread_create(&worker, NULL, air_quality_worker, &job) == 0;
+    ret = read_device(DHT11_CHAR_DEVICE, &record->temperature_humidity, sizeof(struct dht11_measurement));
+    if (worker_started)
+        pthread_join(worker, NULL);
+    else
+        air_quality_worker(&job);
+    if (ret < 0 || job.ret < 0)
+        return -1;
+    record->air_quality = job.measurement;
+    return 0;
+}
+SensorsRecord *read_all(void)
+{
+    SensorsRecord *record = malloc(sizeof(SensorsRecord));
+    if (record == NULL)
+        return NULL;
+    if (read_all_into(record) < 0)
+    {
+        free(record);
+        return NULL;
+    }
+    return record;
+}
@@ -0,0 +1,562 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/homedomotics-store.h"
+
+#define SEGMENT_MAGIC 0x48445453
+#define SEGMENT_VERSION 1
+#define SEGMENT_NAME "%08u.seg"
+#define SEGMENT_NAME_SIZE 16
+// Blocks per segment, at 1 Hz a segment fills up its data area long before its index
+#define INDEX_CAPACITY 4096
+// timestamp, temperature, humidity, air quality and valid flags
+#define FIELDS 5
+#define VALUE_FIELDS 4
+#define NS_PER_MS 1000000ULL
+// Decoding loads 8 bytes at a time and may need one more when a value straddles them
+#define BLOCK_SLACK 9
+#define BLOCK_ALIGN 8
+
+// Layout of a segment: header, index and then the blocks, one after the other
+struct segment_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t segment_size;
+    uint32_t index_capacity;
+    // Updated last, readers never look at blocks past it
+    uint32_t blocks;
+    uint32_t data_used;
+    // in ms
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+};
+struct index_entry
+{
+    uint64_t first_timestamp;
+    uint64_t last_timestamp;
+    uint32_t offset;
+    uint32_t count;
+};
+// Followed by count - 1 packed values of every field, one field after the other
+struct block_header
+{
+    uint64_t first_timestamp;
+    int32_t first[VALUE_FIELDS];
+    // Smallest gap between two samples, the timestamp column only stores how much longer each gap was
+    uint32_t timestamp_delta;
+    uint16_t count;
+    uint8_t width[FIELDS];
+    uint8_t reserved;
+};
+#define DATA_OFFSET (sizeof(struct segment_header) + INDEX_CAPACITY * sizeof(struct index_entry))
+#define DATA_SIZE (SENSORS_STORE_SEGMENT_SIZE - DATA_OFFSET)
+
+// A block once decoded, values in the order of VALUE_FIELDS
+struct block
+{
+    uint64_t timestamp[SENSORS_STORE_BLOCK_SAMPLES];
+    int32_t values[VALUE_FIELDS][SENSORS_STORE_BLOCK_SAMPLES];
+};
+struct segment
+{
+    unsigned int number;
+    // NULL until a query or the writer needs it
+    struct segment_header *header;
+};
+struct sensors_store
+{
+    int directory_fd;
+    unsigned int flags;
+    struct segment *segments;
+    unsigned int nsegments;
+    unsigned int capacity;
+    // Samples waiting for their block to fill up, writers only
+    struct block pending;
+    unsigned int npending;
+    uint64_t last_timestamp;
+    struct block decoded;
+};
+
+static unsigned int bits_needed(uint64_t value)
+{
+    return value == 0 ? 0 : 64 - __builtin_clzll(value);
+}
+static uint64_t zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+static int64_t unzigzag(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+// Bits are packed LSB first, which matches a little-endian load in get_bits
+static void put_bits(uint8_t *out, size_t *bit, uint64_t value, unsigned int width)
+{
+    while (width > 0)
+    {
+        unsigned int shift = *bit % 8;
+        unsigned int take = 8 - shift < width ? 8 - shift : width;
+        out[*bit / 8] |= (uint8_t)((value & ((1U << take) - 1)) << shift);
+        value >>= take;
+        width -= take;
+        *bit += take;
+    }
+}
+static uint64_t get_bits(const uint8_t *in, size_t bit, unsigned int width)
+{
+    unsigned int shift = bit % 8;
+    uint64_t word;
+    if (width == 0)
+        return 0;
+    memcpy(&word, in + bit / 8, sizeof(word));
+    word >>= shift;
+    if (width + shift > 64)
+        word |= (uint64_t)in[bit / 8 + 8] << (64 - shift);
+    return width == 64 ? word : word & ((1ULL << width) - 1);
+}
+
+// Returns the size of the encoded block, or 0 when it does not fit in room
+static size_t encode_block(const struct block *block, unsigned int count, uint8_t *out, size_t room)
+{
+    struct block_header header = {.first_timestamp = block->timestamp[0], .count = count};
+    uint64_t largest[FIELDS] = {0};
+    uint8_t *bits = out + sizeof(struct block_header);
+    size_t size, total_width = 0, bit = 0;
+    header.timestamp_delta = UINT32_MAX;
+    for (unsigned int i = 1; i < count; i++)
+        if (block->timestamp[i] - block->timestamp[i - 1] < header.timestamp_delta)
+            header.timestamp_delta = block->timestamp[i] - block->timestamp[i - 1];
+    if (count == 1)
+        header.timestamp_delta = 0;
+    for (unsigned int i = 1; i < count; i++)
+        if (block->timestamp[i] - block->timestamp[i - 1] - header.timestamp_delta > largest[0])
+            largest[0] = block->timestamp[i] - block->timestamp[i - 1] - header.timestamp_delta;
+    for (unsigned int field = 0; field < VALUE_FIELDS; field++)
+    {
+        const int32_t *column = block->values[field];
+        header.first[field] = column[0];
+        for (unsigned int i = 1; i < count; i++)
+            largest[field + 1] |= zigzag((int64_t)column[i] - column[i - 1]);
+    }
+    // Or-ing the values gives the same highest bit as the maximum
+    for (unsigned int field = 0; field < FIELDS; field++)
+    {
+        header.width[field] = bits_needed(largest[field]);
+        total_width += header.width[field];
+    }
+    size = sizeof(struct block_header) + (total_width * (count - 1) + 7) / 8 + BLOCK_SLACK;
+    size = (size + BLOCK_ALIGN - 1) & ~(size_t)(BLOCK_ALIGN - 1);
+    if (size > room)
+        return 0;
+    memset(out, 0, size);
+    memcpy(out, &header, sizeof(struct block_header));
+    for (unsigned int i = 1; i < count; i++)
+        put_bits(bits, &bit, block->timestamp[i] - block->timestamp[i - 1] - header.timestamp_delta,
+                 header.width[0]);
+    for (unsigned int field = 0; field < VALUE_FIELDS; field++)
+    {
+        const int32_t *column = block->values[field];
+        for (unsigned int i = 1; i < count; i++)
+            put_bits(bits, &bit, zigzag((int64_t)column[i] - column[i - 1]), header.width[field + 1]);
+    }
+    return size;
+}
+// Returns how many samples were decoded, 0 for a block that is corrupt or doesn't fit in room
+static unsigned int decode_block(const uint8_t *in, size_t room, struct block *block)
+{
+    const struct block_header *header = (const struct block_header *)in;
+    const uint8_t *bits = in + sizeof(struct block_header);
+    unsigned int count;
+    size_t bit = 0, total_width = 0;
+    if (room < sizeof(struct block_header))
+        return 0;
+    // Everything comes from the file, nothing is used before it's checked
+    count = header->count;
+    if (count == 0 || count > SENSORS_STORE_BLOCK_SAMPLES)
+        return 0;
+    for (unsigned int field = 0; field < FIELDS; field++)
+    {
+        if (header->width[field] > 64)
+            return 0;
+        total_width += header->width[field];
+    }
+    // The same size encode_block gave it, get_bits reads into the slack
+    if (sizeof(struct block_header) + (total_width * (count - 1) + 7) / 8 + BLOCK_SLACK > room)
+        return 0;
+    // One loop per column with a fixed width, so there is nothing to branch on
+    block->timestamp[0] = header->first_timestamp;
+    for (unsigned int i = 1; i < count; i++, bit += header->width[0])
+        block->timestamp[i] = block->timestamp[i - 1] + header->timestamp_delta +
+                              get_bits(bits, bit, header->width[0]);
+    for (unsigned int field = 0; field < VALUE_FIELDS; field++)
+    {
+        int32_t *column = block->values[field];
+        unsigned int width = header->width[field + 1];
+        column[0] = header->first[field];
+        for (unsigned int i = 1; i < count; i++, bit += width)
+            column[i] = (int32_t)(column[i - 1] + unzigzag(get_bits(bits, bit, width)));
+    }
+    return count;
+}
+
+static int add_segment(struct sensors_store *store, unsigned int number)
+{
+    if (store->nsegments == store->capacity)
+    {
+        unsigned int capacity = store->capacity ? 2 * store->capacity : 16;
+        struct segment *segments = realloc(store->segments, capacity * sizeof(struct segment));
+        if (segments == NULL)
+            return -1;
+        store->segments = segments;
+        store->capacity = capacity;
+    }
+    store->segments[store->nsegments].number = number;
+    store->segments[store->nsegments].header = NULL;
+    store->nsegments++;
+    return 0;
+}
+static int compare_segments(const void *a, const void *b)
+{
+    unsigned int first = ((const struct segment *)a)->number;
+    unsigned int second = ((const struct segment *)b)->number;
+    return (first > second) - (first < second);
+}
+static int scan_segments(struct sensors_store *store)
+{
+    struct dirent *entry;
+    DIR *directory;
+    int fd = dup(store->directory_fd);
+    if (fd < 0)
+        return -1;
+    directory = fdopendir(fd);
+    if (directory == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    while ((entry = readdir(directory)) != NULL)
+    {
+        char name[SEGMENT_NAME_SIZE];
+        unsigned int number;
+        // Skips anything that is not exactly one of our names
+        if (sscanf(entry->d_name, "%u", &number) != 1)
+            continue;
+        snprintf(name, sizeof(name), SEGMENT_NAME, number);
+        if (strcmp(name, entry->d_name) != 0)
+            continue;
+        if (add_segment(store, number) < 0)
+        {
+            closedir(directory);
+            return -1;
+        }
+    }
+    closedir(directory);
+    qsort(store->segments, store->nsegments, sizeof(struct segment), compare_segments);
+    return 0;
+}
+// Readers pick up the segments the writer created after they opened the store
+static void refresh_segments(struct sensors_store *store)
+{
+    char name[SEGMENT_NAME_SIZE];
+    if (store->nsegments == 0)
+    {
+        scan_segments(store);
+        return;
+    }
+    for (;;)
+    {
+        snprintf(name, sizeof(name), SEGMENT_NAME, store->segments[store->nsegments - 1].number + 1);
+        if (faccessat(store->directory_fd, name, R_OK, 0) < 0)
+            return;
+        if (add_segment(store, store->segments[store->nsegments - 1].number + 1) < 0)
+            return;
+    }
+}
+static struct segment_header *map_segment(struct sensors_store *store, struct segment *segment, int writable)
+{
+    char name[SEGMENT_NAME_SIZE];
+    struct stat status;
+    void *memory;
+    int fd;
+    if (segment->header != NULL)
+        return segment->header;
+    snprintf(name, sizeof(name), SEGMENT_NAME, segment->number);
+    fd = openat(store->directory_fd, name, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    // A segment the writer is still creating may not have its full size yet
+    if (fstat(fd, &status) < 0 || status.st_size != SENSORS_STORE_SEGMENT_SIZE)
+    {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    // Only the pages a query touches are ever read from disk
+    memory = mmap(NULL, SENSORS_STORE_SEGMENT_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+                  fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return NULL;
+    segment->header = memory;
+    if (segment->header->magic != SEGMENT_MAGIC || segment->header->version != SEGMENT_VERSION ||
+        segment->header->segment_size != SENSORS_STORE_SEGMENT_SIZE ||
+        segment->header->index_capacity != INDEX_CAPACITY)
+    {
+        munmap(memory, SENSORS_STORE_SEGMENT_SIZE);
+        segment->header = NULL;
+        errno = EINVAL;
+        return NULL;
+    }
+    return segment->header;
+}
+static struct segment_header *create_segment(struct sensors_store *store, unsigned int number)
+{
+    char name[SEGMENT_NAME_SIZE];
+    struct segment_header *header;
+    void *memory;
+    int fd;
+    snprintf(name, sizeof(name), SEGMENT_NAME, number);
+    fd = openat(store->directory_fd, name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return NULL;
+    // The file is sparse, only the blocks written so far take space on disk
+    if (ftruncate(fd, SENSORS_STORE_SEGMENT_SIZE) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    memory = mmap(NULL, SENSORS_STORE_SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return NULL;
+    if (add_segment(store, number) < 0)
+    {
+        munmap(memory, SENSORS_STORE_SEGMENT_SIZE);
+        return NULL;
+    }
+    header = memory;
+    header->version = SEGMENT_VERSION;
+    header->segment_size = SENSORS_STORE_SEGMENT_SIZE;
+    header->index_capacity = INDEX_CAPACITY;
+    // Readers skip the segment until the magic is there
+    atomic_store_explicit((_Atomic uint32_t *)&header->magic, SEGMENT_MAGIC, memory_order_release);
+    store->segments[store->nsegments - 1].header = header;
+    return header;
+}
+
+static int write_block(struct sensors_store *store)
+{
+    struct segment *segment = &store->segments[store->nsegments - 1];
+    struct segment_header *header = segment->header;
+    struct index_entry *index = (struct index_entry *)(header + 1);
+    size_t size = 0;
+    if (header->blocks < INDEX_CAPACITY)
+        size = encode_block(&store->pending, store->npending, (uint8_t *)header + DATA_OFFSET + header->data_used,
+                            DATA_SIZE - header->data_used);
+    if (size == 0)
+    {
+        // This segment is full, the block goes first in a new one
+        header = create_segment(store, segment->number + 1);
+        if (header == NULL)
+            return -1;
+        index = (struct index_entry *)(header + 1);
+        size = encode_block(&store->pending, store->npending, (uint8_t *)header + DATA_OFFSET, DATA_SIZE);
+    }
+    index[header->blocks].first_timestamp = store->pending.timestamp[0];
+    index[header->blocks].last_timestamp = store->pending.timestamp[store->npending - 1];
+    index[header->blocks].offset = header->data_used;
+    index[header->blocks].count = store->npending;
+    if (header->blocks == 0)
+        header->first_timestamp = store->pending.timestamp[0];
+    header->last_timestamp = store->pending.timestamp[store->npending - 1];
+    header->data_used += size;
+    // Publishes the block to readers mapping the same file
+    atomic_store_explicit((_Atomic uint32_t *)&header->blocks, header->blocks + 1, memory_order_release);
+    store->npending = 0;
+    return 0;
+}
+
+struct sensors_store *sensors_store_open(const char *directory, unsigned int flags)
+{
+    struct sensors_store *store = calloc(1, sizeof(struct sensors_store));
+    if (store == NULL)
+        return NULL;
+    store->flags = flags;
+    if ((flags & SENSORS_STORE_WRITE) && mkdir(directory, 0755) < 0 && errno != EEXIST)
+        goto free_store;
+    store->directory_fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (store->directory_fd < 0)
+        goto free_store;
+    // The lock goes away with the fd, even if the writer crashes
+    if ((flags & SENSORS_STORE_WRITE) && flock(store->directory_fd, LOCK_EX | LOCK_NB) < 0)
+    {
+        errno = errno == EWOULDBLOCK ? EBUSY : errno;
+        goto close_directory;
+    }
+    if (scan_segments(store) < 0)
+        goto close_directory;
+    if (!(flags & SENSORS_STORE_WRITE))
+        return store;
+    if (store->nsegments == 0)
+    {
+        if (create_segment(store, 0) == NULL)
+            goto close_directory;
+    }
+    else
+    {
+        struct segment_header *header = map_segment(store, &store->segments[store->nsegments - 1], 1);
+        if (header == NULL)
+            goto close_directory;
+        store->last_timestamp = header->last_timestamp;
+    }
+    return store;
+close_directory:
+    close(store->directory_fd);
+free_store:
+    free(store->segments);
+    free(store);
+    return NULL;
+}
+
+int sensors_store_append(struct sensors_store *store, const SensorsSamples *samples)
+{
+    uint64_t last = store->last_timestamp;
+    if (!(store->flags & SENSORS_STORE_WRITE))
+    {
+        errno = EBADF;
+        return -1;
+    }
+    // Checked up front so a failed append leaves nothing behind
+    for (size_t i = 0; i < samples->count; i++)
+    {
+        if (samples->timestamp[i] / NS_PER_MS < last)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        last = samples->timestamp[i] / NS_PER_MS;
+    }
+    for (size_t i = 0; i < samples->count; i++)
+    {
+        unsigned int slot;
+        // A full block is only written when the next sample arrives, so failing here loses nothing
+        if (store->npending == SENSORS_STORE_BLOCK_SAMPLES && write_block(store) < 0)
+            return -1;
+        slot = store->npending++;
+        store->pending.timestamp[slot] = samples->timestamp[i] / NS_PER_MS;
+        store->pending.values[0][slot] = samples->temperature[i];
+        store->pending.values[1][slot] = samples->humidity[i];
+        store->pending.values[2][slot] = samples->air_quality[i];
+        store->pending.values[3][slot] = samples->valid[i];
+        store->last_timestamp = store->pending.timestamp[slot];
+    }
+    return 0;
+}
+
+int sensors_store_flush(struct sensors_store *store)
+{
+    if (!(store->flags & SENSORS_STORE_WRITE))
+        return 0;
+    if (store->npending > 0 && write_block(store) < 0)
+        return -1;
+    return msync(store->segments[store->nsegments - 1].header, SENSORS_STORE_SEGMENT_SIZE, MS_SYNC);
+}
+
+// Copies the samples of a decoded block that fall in [from, to] (in ms)
+static void copy_range(const struct block *block, unsigned int count, uint64_t from, uint64_t to,
+                       SensorsSamples *out)
+{
+    unsigned int i = 0;
+    while (i < count && block->timestamp[i] < from)
+        i++;
+    for (; i < count && block->timestamp[i] <= to && out->count < out->capacity; i++)
+    {
+        size_t slot = out->count++;
+        out->timestamp[slot] = block->timestamp[i] * NS_PER_MS;
+        out->temperature[slot] = block->values[0][i];
+        out->humidity[slot] = block->values[1][i];
+        out->air_quality[slot] = block->values[2][i];
+        out->valid[slot] = (unsigned char)block->values[3][i];
+    }
+}
+// First block that ends at or after from
+static uint32_t find_block(const struct index_entry *index, uint32_t blocks, uint64_t from)
+{
+    uint32_t low = 0, high = blocks;
+    while (low < high)
+    {
+        uint32_t middle = low + (high - low) / 2;
+        if (index[middle].last_timestamp < from)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+size_t sensors_store_query(struct sensors_store *store, unsigned long long from, unsigned long long to,
+                           SensorsSamples *out)
+{
+    size_t start = out->count;
+    // Stored timestamps are whole ms, so round the range inwards
+    uint64_t first = (from + NS_PER_MS - 1) / NS_PER_MS;
+    uint64_t last = to / NS_PER_MS;
+    if (from > to)
+        return 0;
+    if (!(store->flags & SENSORS_STORE_WRITE))
+        refresh_segments(store);
+    for (unsigned int s = 0; s < store->nsegments && out->count < out->capacity; s++)
+    {
+        struct segment_header *header = map_segment(store, &store->segments[s], 0);
+        const struct index_entry *index;
+        uint32_t blocks;
+        if (header == NULL)
+            continue;
+        blocks = atomic_load_explicit((_Atomic uint32_t *)&header->blocks, memory_order_acquire);
+        // A corrupt count would take us past the index
+        if (blocks > INDEX_CAPACITY)
+            blocks = INDEX_CAPACITY;
+        if (blocks == 0 || header->last_timestamp < first)
+            continue;
+        if (header->first_timestamp > last)
+            break;
+        index = (const struct index_entry *)(header + 1);
+        for (uint32_t b = find_block(index, blocks, first);
+             b < blocks && index[b].first_timestamp <= last && out->count < out->capacity; b++)
+        {
+            unsigned int count = 0;
+            if (index[b].offset < DATA_SIZE)
+                count = decode_block((const uint8_t *)header + DATA_OFFSET + index[b].offset,
+                                     DATA_SIZE - index[b].offset, &store->decoded);
+            // Corrupt blocks are skipped, the rest of the segment is still good
+            copy_range(&store->decoded, count, first, last, out);
+        }
+    }
+    // Samples not written yet are still part of the history
+    if (store->npending > 0)
+        copy_range(&store->pending, store->npending, first, last, out);
+    return out->count - start;
+}
+
+void sensors_store_close(struct sensors_store *store)
+{
+    if (store == NULL)
+        return;
+    sensors_store_flush(store);
+    for (unsigned int s = 0; s < store->nsegments; s++)
+        if (store->segments[s].header != NULL)
+            munmap(store->segments[s].header, SENSORS_STORE_SEGMENT_SIZE);
+    close(store->directory_fd);
+    free(store->segments);
+    free(store);
+}
@@ -0,0 +1,338 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "../include/homedomotics-uring.h"
+
+// One entry per device, it's also the index of its registered fd
+#define DHT11_SLOT 0
+#define MQ135_SLOT 1
+#define KY004_SLOT 2
+#define SLOTS 3
+// user_data of the cancellations, reap ignores their completions
+#define CANCEL_TAG SLOTS
+#define RING_ENTRIES 8
+
+struct sensors_uring
+{
+    int ring_fd;
+    unsigned int flags;
+    // submission queue
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    // completion queue
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    int fds[SLOTS];
+    int button_armed;
+    int button_pressed;
+    // registered buffers, the kernel writes the measurements straight here
+    struct dht11_measurement dht11;
+    struct mq135_measurement mq135;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+static int uring_enter(int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+static int uring_register(int ring_fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args);
+}
+static int map_rings(struct sensors_uring *ring, struct io_uring_params *params)
+{
+    ring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    // Newer kernels let us map both rings at once
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size > ring->sq_ring_size)
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+        return -1;
+    if (params->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+            return -1;
+    }
+    ring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        return -1;
+    ring->sq_head = (unsigned int *)((char *)ring->sq_ring + params->sq_off.head);
+    ring->sq_tail = (unsigned int *)((char *)ring->sq_ring + params->sq_off.tail);
+    ring->sq_mask = (unsigned int *)((char *)ring->sq_ring + params->sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)((char *)ring->sq_ring + params->sq_off.array);
+    ring->cq_head = (unsigned int *)((char *)ring->cq_ring + params->cq_off.head);
+    ring->cq_tail = (unsigned int *)((char *)ring->cq_ring + params->cq_off.tail);
+    ring->cq_mask = (unsigned int *)((char *)ring->cq_ring + params->cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ring + params->cq_off.cqes);
+    return 0;
+}
+// The entry at the tail, the kernel doesn't see it until submit_sqe publishes it
+static struct io_uring_sqe *get_sqe(struct sensors_uring *ring)
+{
+    unsigned int index = *ring->sq_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    ring->sq_array[index] = index;
+    return sqe;
+}
+// Called once the entry is filled, the release orders it before the new tail
+static void submit_sqe(struct sensors_uring *ring)
+{
+    __atomic_store_n(ring->sq_tail, *ring->sq_tail + 1, __ATOMIC_RELEASE);
+}
+static void prep_read(struct sensors_uring *ring, int slot, void *buffer, unsigned int size)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = slot;
+    sqe->addr = (unsigned long)buffer;
+    sqe->len = size;
+    // devices are not seekable, read from the current position
+    sqe->off = (__u64)-1;
+    sqe->buf_index = slot;
+    sqe->user_data = slot;
+    submit_sqe(ring);
+}
+static void prep_poll(struct sensors_uring *ring)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = KY004_SLOT;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = KY004_SLOT;
+    submit_sqe(ring);
+}
+static void prep_cancel(struct sensors_uring *ring, int slot)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    // matched against the user_data of the read
+    sqe->addr = slot;
+    sqe->user_data = CANCEL_TAG;
+    submit_sqe(ring);
+}
+// Consumes every available completion, returns how many reads finished or -errno
+static int reap(struct sensors_uring *ring, int *error)
+{
+    int reads = 0;
+    unsigned int head = *ring->cq_head;
+    unsigned int tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        if (cqe->user_data == KY004_SLOT)
+        {
+            ring->button_armed = 0;
+            if (cqe->res > 0)
+                ring->button_pressed = 1;
+        }
+        // A cancellation fails with ENOENT when its read already completed, the read has its
+        // own completion either way
+        else if (cqe->user_data != CANCEL_TAG)
+        {
+            reads++;
+            if (cqe->res < 0)
+                *error = cqe->res;
+        }
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return reads;
+}
+static void unmap_rings(struct sensors_uring *ring)
+{
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+        munmap(ring->sq_ring, ring->sq_ring_size);
+}
+
+// After a failed io_uring_enter the reads may still be queued or running. The next collect
+// would reap their completions as its own, so they are cancelled and waited for here. pending
+// is how many reads haven't completed yet
+static void abandon_reads(struct sensors_uring *ring, int pending)
+{
+    int error = 0;
+    unsigned int to_submit;
+    pending -= reap(ring, &error);
+    if (pending <= 0)
+        return;
+    prep_cancel(ring, DHT11_SLOT);
+    prep_cancel(ring, MQ135_SLOT);
+    while (pending > 0)
+    {
+        // The reads themselves too, when the failed call didn't get to submit them
+        to_submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        // Nothing more we can do with a ring that keeps failing
+        if (uring_enter(ring->ring_fd, to_submit, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return;
+        pending -= reap(ring, &error);
+    }
+}
+
+struct sensors_uring *sensors_uring_open(unsigned int flags)
+{
+    struct io_uring_params params;
+    struct iovec buffers[SLOTS];
+    int saved_errno;
+    struct sensors_uring *ring = calloc(1, sizeof(struct sensors_uring));
+    if (ring == NULL)
+        return NULL;
+    ring->flags = flags;
+    ring->ring_fd = -1;
+    for (int i = 0; i < SLOTS; i++)
+        ring->fds[i] = -1;
+    if ((ring->fds[DHT11_SLOT] = open(DHT11_CHAR_DEVICE, O_RDONLY)) < 0)
+        goto error;
+    if ((ring->fds[MQ135_SLOT] = open(MQ135_DEVICE, O_RDONLY)) < 0)
+        goto error;
+    if ((flags & SENSORS_URING_BUTTON) && (ring->fds[KY004_SLOT] = open(KY004_DEVICE, O_RDONLY)) < 0)
+        goto error;
+    memset(&params, 0, sizeof(struct io_uring_params));
+    if ((ring->ring_fd = uring_setup(RING_ENTRIES, &params)) < 0)
+        goto error;
+    if (map_rings(ring, &params) < 0)
+        goto error;
+    // -1 entries are left as sparse slots
+    if (uring_register(ring->ring_fd, IORING_REGISTER_FILES, ring->fds, SLOTS) < 0)
+        goto error;
+    buffers[DHT11_SLOT].iov_base = &ring->dht11;
+    buffers[DHT11_SLOT].iov_len = sizeof(struct dht11_measurement);
+    buffers[MQ135_SLOT].iov_base = &ring->mq135;
+    buffers[MQ135_SLOT].iov_len = sizeof(struct mq135_measurement);
+    if (uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS, buffers, 2) < 0)
+        goto error;
+    return ring;
+error:
+    saved_errno = errno;
+    sensors_uring_close(ring);
+    errno = saved_errno;
+    return NULL;
+}
+int sensors_uring_collect(struct sensors_uring *ring, SensorsRecord *record, int *button_pressed)
+{
+    struct timespec now;
+    unsigned int submit = 2;
+    int pending = 2, error = 0, ret;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->timestamp = (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    prep_read(ring, DHT11_SLOT, &ring->dht11, sizeof(struct dht11_measurement));
+    prep_read(ring, MQ135_SLOT, &ring->mq135, sizeof(struct mq135_measurement));
+    if ((ring->flags & SENSORS_URING_BUTTON) && !ring->button_armed)
+    {
+        prep_poll(ring);
+        ring->button_armed = 1;
+        submit++;
+    }
+    // Submit everything and wait for both reads in the same call
+    ret = uring_enter(ring->ring_fd, submit, pending, IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno != EINTR)
+    {
+        ret = -errno;
+        abandon_reads(ring, pending);
+        return ret;
+    }
+    while ((pending -= reap(ring, &error)) > 0)
+    {
+        // Submits whatever an interrupted call left behind
+        submit = *ring->sq_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        ret = uring_enter(ring->ring_fd, submit, pending, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR)
+        {
+            ret = -errno;
+            abandon_reads(ring, pending);
+            return ret;
+        }
+    }
+    if (error < 0)
+        return error;
+    record->temperature_humidity = ring->dht11;
+    record->air_quality = ring->mq135;
+    if (button_pressed != NULL)
+    {
+        *button_pressed = ring->button_pressed;
+        ring->button_pressed = 0;
+    }
+    return 0;
+}
+int sensors_uring_wait_button(struct sensors_uring *ring)
+{
+    int error = 0;
+    if (!(ring->flags & SENSORS_URING_BUTTON))
+        return -EINVAL;
+    if (!ring->button_armed)
+    {
+        prep_poll(ring);
+        ring->button_armed = 1;
+        if (uring_enter(ring->ring_fd, 1, 0, 0) < 0)
+            return -errno;
+    }
+    while (!ring->button_pressed)
+    {
+        if (uring_enter(ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -errno;
+        reap(ring, &error);
+        // the poll completed without POLLIN, arm it again
+        if (!ring->button_armed && !ring->button_pressed)
+        {
+            prep_poll(ring);
+            ring->button_armed = 1;
+            if (uring_enter(ring->ring_fd, 1, 0, 0) < 0)
+                return -errno;
+        }
+    }
+    ring->button_pressed = 0;
+    return 1;
+}
+void sensors_uring_close(struct sensors_uring *ring)
+{
+    if (ring == NULL)
+        return;
+    unmap_rings(ring);
+    if (ring->ring_fd >= 0)
+        close(ring->ring_fd);
+    for (int i = 0; i < SLOTS; i++)
+        if (ring->fds[i] >= 0)
+            close(ring->fds[i]);
+    free(ring);
+}
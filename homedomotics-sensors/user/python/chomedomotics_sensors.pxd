@@ -10,8 +10,32 @@ cdef extern from "../../include/homedomotics-sensors.h":
         int humidity_decimal;
         int temperature;
         int temperature_decimal;
+    ctypedef struct SensorsRecord:
+        unsigned long long timestamp;
+        TemperatureHumidity temperature_humidity;
+        AirQuality air_quality;
 
-    bint wait_to_read();
-    AirQuality *read_air_quality();
-    TemperatureHumidity *read_temperature_humidity();
-    
\ No newline at end of file
+    const char *KY004_DEVICE
+
+    # None of these touch Python objects, so they can run without the GIL
+    bint wait_to_read() nogil;
+    AirQuality *read_air_quality() nogil;
+    TemperatureHumidity *read_temperature_humidity() nogil;
+    SensorsRecord *read_all() nogil;
+
+cdef extern from "../../include/homedomotics-samples.h":
+    ctypedef struct SensorsSamples:
+        size_t count;
+        size_t capacity;
+        unsigned long long *timestamp;
+        int *temperature;
+        int *humidity;
+        int *air_quality;
+        unsigned char *valid;
+
+    SensorsSamples *sensors_samples_alloc(size_t capacity) nogil;
+    void sensors_samples_free(SensorsSamples *samples) nogil;
+    size_t sensors_samples_read(SensorsSamples *samples, size_t count, unsigned int period_ms) nogil;
+
+cdef extern from "../../include/dht11-decode.h":
+    int dht11_to_hundredths(unsigned char value, unsigned char decimal) nogil;
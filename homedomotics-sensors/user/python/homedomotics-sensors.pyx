@@ -1,26 +1,41 @@
-# distutils: sources = ../lib/homedomotics-sensors.c
+# distutils: sources = ../lib/homedomotics-sensors.c ../lib/homedomotics-samples.c ../lib/homedomotics-uring.c
 # distutils: include_dirs = ../../include
+# distutils: libraries = pthread
 
+import asyncio
+import os
+import select
+import time
 import cython
 from cython.cimports.libc.stdlib import free
-from cython.cimports.libc import math
+from cython.cimports.posix.unistd import close
+cimport cpython
 cimport chomedomotics_sensors
 
+# Same as the debounce interval of the KY-004 driver
+BUTTON_DEBOUNCE = 0.2
+
 # cdef class allows storing arbitrary c types in its fields
 cdef class SensorsData:
+    cdef unsigned long long _timestamp
     cdef bint _read_temperature_humidity
     cdef float _temperature
     cdef float _humidity 
     cdef bint _read_air_quality
     cdef int _air_quality
 
-    def __cinit__(self, read_temp_hum, temperature, humidity, read_air_quality, air_quality):
+    def __cinit__(self, read_temp_hum, temperature, humidity, read_air_quality, air_quality, timestamp=0):
+        self._timestamp = timestamp
         self._read_temperature_humidity = read_temp_hum
         self._temperature = temperature
         self._humidity = humidity
         self._read_air_quality = read_air_quality
         self._air_quality = air_quality
     
+    @property
+    def timestamp(self):
+        return self._timestamp
+
     @property
     def read_temperature_humidity(self):
         return self._read_temperature_humidity
@@ -40,36 +55,172 @@ cdef class SensorsData:
     def air_quality(self):
         return self._air_quality
 
-cdef closest_power_ten(int v):
-    return math.pow(10, math.floor(math.log10(v)));
+# One column of a Samples container. It exports the C array through the buffer
+# protocol, so numpy.asarray() wraps it without copying
+cdef class SampleColumn:
+    cdef object _owner
+    cdef void *_data
+    cdef const char *_format
+    cdef Py_ssize_t _shape[1]
+    cdef Py_ssize_t _strides[1]
+
+    def __len__(self):
+        return self._shape[0]
+
+    def __getbuffer__(self, Py_buffer *buffer, int flags):
+        buffer.buf = self._data
+        buffer.obj = self
+        buffer.len = self._shape[0] * self._strides[0]
+        buffer.readonly = 1
+        buffer.itemsize = self._strides[0]
+        buffer.format = NULL
+        if flags & cpython.PyBUF_FORMAT:
+            buffer.format = <char *>self._format
+        buffer.ndim = 1
+        buffer.shape = self._shape
+        buffer.strides = self._strides
+        buffer.suboffsets = NULL
+        buffer.internal = NULL
+
+    def __releasebuffer__(self, Py_buffer *buffer):
+        pass
+
+cdef SampleColumn _column(object owner, void *data, Py_ssize_t length, Py_ssize_t itemsize, const char *format):
+    cdef SampleColumn column = SampleColumn.__new__(SampleColumn)
+    # keeps the samples (and their memory) alive while the column is in use
+    column._owner = owner
+    column._data = data
+    column._format = format
+    column._shape[0] = length
+    column._strides[0] = itemsize
+    return column
+
+# Structure of arrays returned by Sensors.read_samples(). Temperature and humidity
+# are in hundredths, air quality is the raw ADS1115 count
+cdef class Samples:
+    cdef chomedomotics_sensors.SensorsSamples *_samples
+
+    def __cinit__(self, size_t capacity):
+        self._samples = chomedomotics_sensors.sensors_samples_alloc(capacity)
+        if self._samples is cython.NULL:
+            raise MemoryError()
+
+    def __dealloc__(self):
+        chomedomotics_sensors.sensors_samples_free(self._samples)
+
+    def __len__(self):
+        return self._samples.count
+
+    @property
+    def timestamps(self):
+        return _column(self, self._samples.timestamp, self._samples.count, sizeof(unsigned long long), b"Q")
+
+    @property
+    def temperature(self):
+        return _column(self, self._samples.temperature, self._samples.count, sizeof(int), b"i")
+
+    @property
+    def humidity(self):
+        return _column(self, self._samples.humidity, self._samples.count, sizeof(int), b"i")
+
+    @property
+    def air_quality(self):
+        return _column(self, self._samples.air_quality, self._samples.count, sizeof(int), b"i")
+
+    @property
+    def valid(self):
+        return _column(self, self._samples.valid, self._samples.count, sizeof(unsigned char), b"B")
+
+def _wait_readable(loop, fd):
+    future = loop.create_future()
+    def ready():
+        loop.remove_reader(fd)
+        if not future.done():
+            future.set_result(None)
+    loop.add_reader(fd, ready)
+    return future
+
+def _is_readable(fd):
+    readable, _, _ = select.select([fd], [], [], 0)
+    return bool(readable)
 
 cdef class Sensors:
+    cdef int _button_fd
+
     def __cinit__(self):
-        pass
+        self._button_fd = -1
+
+    def __dealloc__(self):
+        if self._button_fd >= 0:
+            close(self._button_fd)
+
+    # The KY-004 device, it polls readable while the button is on.
+    # Lets a Sensors object be handed to select/selectors/asyncio directly
+    def fileno(self):
+        if self._button_fd < 0:
+            self._button_fd = os.open(chomedomotics_sensors.KY004_DEVICE.decode(), os.O_RDONLY | os.O_NONBLOCK)
+        return self._button_fd
 
     # Can be called from python, c and cython
     # cdef can be called from cython and C
     # def can only be called from python
     cpdef wait_for_read(self):
-        return chomedomotics_sensors.wait_to_read()
+        cdef bint ret
+        # Other python threads keep running while we wait for the button
+        with nogil:
+            ret = chomedomotics_sensors.wait_to_read()
+        return ret
 
     cpdef read_sensors(self):
-        cdef chomedomotics_sensors.TemperatureHumidity *read_temperature_data = chomedomotics_sensors.read_temperature_humidity()
-        if read_temperature_data is cython.NULL:
-            raise IOError("Failed at reading temperature and humidity")
-        cdef chomedomotics_sensors.AirQuality *air_quality_data = chomedomotics_sensors.read_air_quality()
-        if air_quality_data is cython.NULL:
-            free(read_temperature_data)
-            raise IOError("Failed at reading air quality")
+        # Both devices are read concurrently, so this takes as long as the slower sensor
+        cdef chomedomotics_sensors.SensorsRecord *record
+        with nogil:
+            record = chomedomotics_sensors.read_all()
+        if record is cython.NULL:
+            raise IOError("Failed at reading sensors")
+        cdef chomedomotics_sensors.TemperatureHumidity *read_temperature_data = &record.temperature_humidity
+        cdef chomedomotics_sensors.AirQuality *air_quality_data = &record.air_quality
         return_data = SensorsData(read_temperature_data.successful,
-                                  read_temperature_data.temperature +
-                                  read_temperature_data.temperature_decimal*1.0/(10*closest_power_ten(read_temperature_data.temperature_decimal)),
-                                  read_temperature_data.humidity +
-                                  read_temperature_data.humidity_decimal*1.0/(10*closest_power_ten(read_temperature_data.humidity_decimal)),
+                                  chomedomotics_sensors.dht11_to_hundredths(read_temperature_data.temperature,
+                                                                            read_temperature_data.temperature_decimal) / 100.0,
+                                  chomedomotics_sensors.dht11_to_hundredths(read_temperature_data.humidity,
+                                                                            read_temperature_data.humidity_decimal) / 100.0,
                                   air_quality_data.read_data,
-                                  air_quality_data.air_quality)
-        free(read_temperature_data)
-        free(air_quality_data)
+                                  air_quality_data.air_quality,
+                                  record.timestamp)
+        free(record)
         return return_data
 
+    # Reads count samples, period_ms apart, into one Samples container without holding the GIL.
+    # The batch stops at the first failed read, like read_sensors that raises IOError
+    def read_samples(self, size_t count, unsigned int period_ms=1000):
+        cdef Samples samples = Samples(count)
+        cdef size_t read_count
+        with nogil:
+            read_count = chomedomotics_sensors.sensors_samples_read(samples._samples, count, period_ms)
+        if read_count < count:
+            raise IOError("Failed at reading sensors after %d of %d samples" % (read_count, count))
+        return samples
+
+    # Yields the time of every KY-004 press without blocking the event loop
+    async def button_events(self):
+        loop = asyncio.get_running_loop()
+        fd = self.fileno()
+        try:
+            while True:
+                await _wait_readable(loop, fd)
+                yield time.time()
+                # poll() stays readable until the button is toggled off again
+                while _is_readable(fd):
+                    await asyncio.sleep(BUTTON_DEBOUNCE)
+        finally:
+            loop.remove_reader(fd)
 
+    # Yields a SensorsData every period seconds, the reads run on the default executor
+    async def samples(self, period=1.0):
+        loop = asyncio.get_running_loop()
+        deadline = loop.time()
+        while True:
+            yield await loop.run_in_executor(None, self.read_sensors)
+            deadline += period
+            await asyncio.sleep(max(0.0, deadline - loop.time()))
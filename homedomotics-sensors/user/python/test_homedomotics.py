@@ -7,3 +7,4 @@ print(data.temperature)
 print(data.humidity)
 print(data.read_air_quality)
 print(data.air_quality)
+print(data.timestamp)
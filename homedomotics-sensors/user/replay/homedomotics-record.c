@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "../include/homedomotics-sensors.h"
+#include "../include/homedomotics-netlink.h"
+#include "../include/homedomotics-recording.h"
+
+// The DHT11 driver hands back its cached value when read more often than once a second
+#define DEFAULT_PERIOD_MS 1000
+
+enum recorder_fds
+{
+    SIGNAL_FD,
+    TIMER_FD,
+    NETLINK_FD,
+    RECORDER_FDS,
+};
+
+struct recorder
+{
+    struct sensors_recording *recording;
+    // NULL without the sensor-hub module, there are no KY-004 events then
+    struct sensors_netlink *subscriber;
+    unsigned long long events;
+    unsigned long long failures;
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s -o recording [-p period_ms] [-d seconds]\n", name);
+    fprintf(stderr, "  -o  file the events are written to\n");
+    fprintf(stderr, "  -p  DHT11 and MQ135 sampling period in ms (default %d)\n", DEFAULT_PERIOD_MS);
+    fprintf(stderr, "  -d  stop after this many seconds (default until SIGINT or SIGTERM)\n");
+}
+
+static int create_timer(unsigned int period_ms)
+{
+    struct itimerspec period = {
+        .it_interval = {.tv_sec = period_ms / 1000, .tv_nsec = (period_ms % 1000) * 1000000L},
+        .it_value = {.tv_nsec = 1},
+    };
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (timerfd_settime(fd, 0, &period, NULL) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int create_signals(void)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+        return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static int record(struct recorder *recorder, const SensorsEvent *event)
+{
+    if (sensors_recording_write(recorder->recording, event) < 0)
+    {
+        perror("Could not write the recording");
+        return -1;
+    }
+    recorder->events++;
+    return 0;
+}
+
+// Both sensors go through read_all_into, each one becomes its own event
+static int sample(struct recorder *recorder, int timer_fd)
+{
+    SensorsRecord sensors;
+    SensorsEvent event;
+    unsigned long long expirations;
+    // We may have missed ticks while reading, there is no point in catching up on them
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+        return 0;
+    if (read_all_into(&sensors) < 0)
+    {
+        // Only the first of a row of failures is logged
+        if (recorder->failures++ == 0)
+            perror("Could not read sensors");
+        return 0;
+    }
+    recorder->failures = 0;
+    memset(&event, 0, sizeof(event));
+    event.timestamp = sensors.timestamp;
+    event.type = SENSORS_EVENT_DHT11;
+    event.temperature_humidity = sensors.temperature_humidity;
+    if (record(recorder, &event) < 0)
+        return -1;
+    memset(&event, 0, sizeof(event));
+    event.timestamp = sensors.timestamp;
+    event.type = SENSORS_EVENT_MQ135;
+    event.air_quality = sensors.air_quality;
+    return record(recorder, &event);
+}
+
+// The KY-004 device only says whether the LED is on, the presses come from the sensor hub.
+// Records of the other sensors are ignored, we sample them ourselves at the requested period
+static int button_presses(struct recorder *recorder)
+{
+    struct sensor_hub_record records[SENSOR_HUB_GENL_BATCH];
+    SensorsEvent event;
+    int received = sensors_netlink_receive(recorder->subscriber, records, SENSOR_HUB_GENL_BATCH);
+    if (received < 0)
+    {
+        if (errno == ENOBUFS)
+        {
+            fprintf(stderr, "KY-004 events were lost\n");
+            return 0;
+        }
+        perror("sensors_netlink_receive");
+        return -1;
+    }
+    for (int i = 0; i < received; i++)
+    {
+        if (records[i].version != SENSOR_HUB_RECORD_VERSION || records[i].type != SENSOR_HUB_KY004)
+            continue;
+        memset(&event, 0, sizeof(event));
+        event.timestamp = records[i].timestamp;
+        event.type = SENSORS_EVENT_KY004;
+        event.button.on = records[i].value[0];
+        event.button.presses = records[i].value[1];
+        if (record(recorder, &event) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static int run(struct recorder *recorder, struct pollfd *fds, unsigned int seconds)
+{
+    struct timespec start, now;
+    int timeout = -1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;)
+    {
+        int ready;
+        if (seconds > 0)
+        {
+            long long elapsed_ms;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            elapsed_ms = (now.tv_sec - start.tv_sec) * 1000LL + (now.tv_nsec - start.tv_nsec) / 1000000;
+            if (elapsed_ms >= seconds * 1000LL)
+                return 0;
+            timeout = (int)(seconds * 1000LL - elapsed_ms);
+        }
+        ready = poll(fds, RECORDER_FDS, timeout);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 1;
+        }
+        if (fds[SIGNAL_FD].revents & POLLIN)
+            return 0;
+        if ((fds[TIMER_FD].revents & POLLIN) && sample(recorder, fds[TIMER_FD].fd) < 0)
+            return 1;
+        if ((fds[NETLINK_FD].revents & POLLIN) && button_presses(recorder) < 0)
+            return 1;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    struct recorder recorder = {0};
+    struct pollfd fds[RECORDER_FDS];
+    const char *path = NULL;
+    unsigned int period_ms = DEFAULT_PERIOD_MS, seconds = 0;
+    int opt, ret = 1;
+    while ((opt = getopt(argc, argv, "o:p:d:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'o':
+            path = optarg;
+            break;
+        case 'p':
+            period_ms = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            seconds = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (path == NULL || period_ms == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    recorder.recording = sensors_recording_create(path);
+    if (recorder.recording == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    recorder.subscriber = sensors_netlink_open();
+    if (recorder.subscriber == NULL)
+        fprintf(stderr, "Sensor hub not available (%s), recording without KY-004 events\n", strerror(errno));
+    fds[SIGNAL_FD].fd = create_signals();
+    fds[TIMER_FD].fd = create_timer(period_ms);
+    // poll ignores negative fds
+    fds[NETLINK_FD].fd = recorder.subscriber != NULL ? sensors_netlink_fd(recorder.subscriber) : -1;
+    for (unsigned int i = 0; i < RECORDER_FDS; i++)
+        fds[i].events = POLLIN;
+    if (fds[SIGNAL_FD].fd < 0 || fds[TIMER_FD].fd < 0)
+        perror("Could not set up the recorder");
+    else
+        ret = run(&recorder, fds, seconds);
+    close(fds[SIGNAL_FD].fd);
+    close(fds[TIMER_FD].fd);
+    sensors_netlink_close(recorder.subscriber);
+    if (sensors_recording_close(recorder.recording) < 0)
+    {
+        perror("Could not write the recording");
+        ret = 1;
+    }
+    fprintf(stderr, "%llu events recorded\n", recorder.events);
+    return ret;
+}
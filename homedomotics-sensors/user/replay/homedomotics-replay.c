@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#define FUSE_USE_VERSION 31
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <cuse_lowlevel.h>
+#include "../include/homedomotics-sensors.h"
+#include "../include/homedomotics-recording.h"
+
+// Stands in for the three drivers with CUSE character devices, serving a recording made by
+// homedomotics-record up to MAX_SPEED times faster than it happened. Consumers, the library
+// and the Python bindings open the usual /dev nodes and can't tell the difference, except
+// that read() returns the size of the measurement where the drivers return 0.
+
+#define MIN_SPEED 1.0
+#define MAX_SPEED 1000.0
+#define DEVICE_NAME_SIZE 64
+
+struct replay_file
+{
+    struct replay_file *next;
+    // Set while poll() waits for the LED to turn on
+    struct fuse_pollhandle *poll_handle;
+};
+
+struct replay_device
+{
+    enum sensors_event_type type;
+    const char *path;
+    char dev_info[DEVICE_NAME_SIZE];
+    struct fuse_session *session;
+    pthread_t thread;
+    // Everything below is protected by state_mutex
+    SensorsEvent current;
+    struct replay_file *files;
+};
+
+enum replay_devices
+{
+    REPLAY_DHT11,
+    REPLAY_MQ135,
+    REPLAY_KY004,
+    REPLAY_DEVICES,
+};
+
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct replay_device devices[REPLAY_DEVICES] = {
+    [REPLAY_DHT11] = {.type = SENSORS_EVENT_DHT11, .path = DHT11_CHAR_DEVICE},
+    [REPLAY_MQ135] = {.type = SENSORS_EVENT_MQ135, .path = MQ135_DEVICE},
+    [REPLAY_KY004] = {.type = SENSORS_EVENT_KY004, .path = KY004_DEVICE},
+};
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s -i recording [-s speed] [-l] [-n prefix]\n", name);
+    fprintf(stderr, "  -i  recording made by homedomotics-record\n");
+    fprintf(stderr, "  -s  how many times faster than recorded, %g to %g (default 1)\n", MIN_SPEED, MAX_SPEED);
+    fprintf(stderr, "  -l  start over at the end of the recording\n");
+    fprintf(stderr, "  -n  prefix for the device names, to run next to the real drivers\n");
+}
+
+static void replay_open(fuse_req_t req, struct fuse_file_info *fi)
+{
+    struct replay_device *device = fuse_req_userdata(req);
+    struct replay_file *file = calloc(1, sizeof(struct replay_file));
+    if (file == NULL)
+    {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    pthread_mutex_lock(&state_mutex);
+    file->next = device->files;
+    device->files = file;
+    pthread_mutex_unlock(&state_mutex);
+    fi->fh = (uintptr_t)file;
+    fi->direct_io = 1;
+    fi->nonseekable = 1;
+    fuse_reply_open(req, fi);
+}
+
+static void replay_release(fuse_req_t req, struct fuse_file_info *fi)
+{
+    struct replay_device *device = fuse_req_userdata(req);
+    struct replay_file *file = (struct replay_file *)(uintptr_t)fi->fh;
+    pthread_mutex_lock(&state_mutex);
+    for (struct replay_file **link = &device->files; *link != NULL; link = &(*link)->next)
+    {
+        if (*link != file)
+            continue;
+        *link = file->next;
+        break;
+    }
+    pthread_mutex_unlock(&state_mutex);
+    if (file->poll_handle != NULL)
+        fuse_pollhandle_destroy(file->poll_handle);
+    free(file);
+    fuse_reply_err(req, 0);
+}
+
+// Until the first event the measurements are zeroed, so they read as unsuccessful
+static void replay_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    struct replay_device *device = fuse_req_userdata(req);
+    SensorsEvent event;
+    pthread_mutex_lock(&state_mutex);
+    event = device->current;
+    pthread_mutex_unlock(&state_mutex);
+    switch (device->type)
+    {
+    case SENSORS_EVENT_DHT11:
+        if (size < sizeof(TemperatureHumidity))
+            fuse_reply_err(req, EFAULT);
+        else
+            fuse_reply_buf(req, (const char *)&event.temperature_humidity, sizeof(TemperatureHumidity));
+        break;
+    case SENSORS_EVENT_MQ135:
+        if (size < sizeof(AirQuality))
+            fuse_reply_err(req, EINVAL);
+        else
+            fuse_reply_buf(req, (const char *)&event.air_quality, sizeof(AirQuality));
+        break;
+    default:
+        // The KY-004 driver can only be polled
+        fuse_reply_err(req, EINVAL);
+    }
+}
+
+// Like the drivers: the KY-004 is readable while the LED is on, the others always are
+static void replay_poll(fuse_req_t req, struct fuse_file_info *fi, struct fuse_pollhandle *poll_handle)
+{
+    struct replay_device *device = fuse_req_userdata(req);
+    struct replay_file *file = (struct replay_file *)(uintptr_t)fi->fh;
+    struct fuse_pollhandle *previous = NULL;
+    unsigned int revents = POLLIN | POLLRDNORM;
+    if (device->type != SENSORS_EVENT_KY004)
+    {
+        if (poll_handle != NULL)
+            fuse_pollhandle_destroy(poll_handle);
+        fuse_reply_poll(req, revents);
+        return;
+    }
+    pthread_mutex_lock(&state_mutex);
+    if (!device->current.button.on)
+    {
+        revents = 0;
+        previous = file->poll_handle;
+        file->poll_handle = poll_handle;
+        poll_handle = NULL;
+    }
+    pthread_mutex_unlock(&state_mutex);
+    if (previous != NULL)
+        fuse_pollhandle_destroy(previous);
+    if (poll_handle != NULL)
+        fuse_pollhandle_destroy(poll_handle);
+    fuse_reply_poll(req, revents);
+}
+
+static const struct cuse_lowlevel_ops replay_ops = {
+    .open = replay_open,
+    .release = replay_release,
+    .read = replay_read,
+    .poll = replay_poll,
+};
+
+static void *device_loop(void *arg)
+{
+    struct replay_device *device = arg;
+    fuse_session_loop(device->session);
+    return NULL;
+}
+
+static int start_device(struct replay_device *device, const char *prefix)
+{
+    char program[] = "homedomotics-replay", foreground[] = "-f";
+    char *argv[] = {program, foreground, NULL};
+    const char *dev_info[] = {device->dev_info};
+    struct cuse_info info = {.dev_info_argc = 1, .dev_info_argv = dev_info};
+    int multithreaded;
+    // /dev/dht11_module becomes DEVNAME=<prefix>dht11_module
+    snprintf(device->dev_info, sizeof(device->dev_info), "DEVNAME=%s%s", prefix, strrchr(device->path, '/') + 1);
+    device->session = cuse_lowlevel_setup(2, argv, &info, &replay_ops, &multithreaded, device);
+    if (device->session == NULL)
+        return -1;
+    if (pthread_create(&device->thread, NULL, device_loop, device) != 0)
+        return -1;
+    return 0;
+}
+
+static void apply(const SensorsEvent *event)
+{
+    struct replay_device *device = NULL;
+    for (unsigned int i = 0; i < REPLAY_DEVICES; i++)
+        if (devices[i].type == event->type)
+            device = &devices[i];
+    if (device == NULL)
+        return;
+    pthread_mutex_lock(&state_mutex);
+    device->current = *event;
+    // Pollers only wait on the KY-004 while the LED is off
+    if (event->type == SENSORS_EVENT_KY004 && event->button.on)
+    {
+        for (struct replay_file *file = device->files; file != NULL; file = file->next)
+        {
+            if (file->poll_handle == NULL)
+                continue;
+            fuse_lowlevel_notify_poll(file->poll_handle);
+            fuse_pollhandle_destroy(file->poll_handle);
+            file->poll_handle = NULL;
+        }
+    }
+    pthread_mutex_unlock(&state_mutex);
+}
+
+static unsigned long long monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Sleeps until due (CLOCK_MONOTONIC, in ns). Returns 1 when a signal asked us to stop
+static int wait_until(unsigned long long due, const sigset_t *signals)
+{
+    for (;;)
+    {
+        unsigned long long now = monotonic_ns();
+        struct timespec timeout;
+        int signal;
+        // Events recorded out of order (a button press during a sample) are just late
+        if (now >= due)
+            return 0;
+        timeout.tv_sec = (due - now) / 1000000000ULL;
+        timeout.tv_nsec = (due - now) % 1000000000ULL;
+        signal = sigtimedwait(signals, NULL, &timeout);
+        if (signal > 0)
+            return 1;
+    }
+}
+
+// Events are applied at start + (timestamp - first timestamp) / speed. With loop every pass
+// starts where the previous one ended
+static int replay(struct sensors_recording *recording, double speed, int loop, const sigset_t *signals)
+{
+    SensorsEvent event;
+    unsigned long long start = monotonic_ns(), first = 0, offset = 0, last = 0, events = 0;
+    int first_read = 1, ret;
+    for (;;)
+    {
+        ret = sensors_recording_read(recording, &event);
+        if (ret < 0)
+        {
+            perror("Could not read the recording");
+            return 1;
+        }
+        if (ret == 0)
+        {
+            if (!loop || events == 0)
+                break;
+            if (sensors_recording_rewind(recording) < 0)
+            {
+                perror("Could not rewind the recording");
+                return 1;
+            }
+            // A ms apart, so a recording of one instant doesn't turn into a busy loop
+            offset = last + 1000000;
+            first_read = 1;
+            continue;
+        }
+        if (first_read)
+        {
+            first = event.timestamp;
+            first_read = 0;
+        }
+        last = offset + (event.timestamp >= first ? event.timestamp - first : 0);
+        if (wait_until(start + (unsigned long long)(last / speed), signals))
+            return 0;
+        apply(&event);
+        events++;
+    }
+    fprintf(stderr, "%llu events replayed, waiting for a signal to stop\n", events);
+    // Consumers can keep reading the last values
+    while (sigwaitinfo(signals, NULL) < 0)
+        ;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sensors_recording *recording;
+    const char *path = NULL, *prefix = "";
+    double speed = 1.0;
+    int opt, loop = 0, ret;
+    sigset_t signals;
+    while ((opt = getopt(argc, argv, "i:s:ln:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            path = optarg;
+            break;
+        case 's':
+            speed = strtod(optarg, NULL);
+            break;
+        case 'l':
+            loop = 1;
+            break;
+        case 'n':
+            prefix = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (path == NULL || !(speed >= MIN_SPEED && speed <= MAX_SPEED))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    recording = sensors_recording_open(path);
+    if (recording == NULL)
+    {
+        perror(path);
+        return 1;
+    }
+    // Blocked before any thread starts, only sigtimedwait gets them. CUSE installs its own
+    // handlers, they never run
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    for (unsigned int i = 0; i < REPLAY_DEVICES; i++)
+    {
+        if (start_device(&devices[i], prefix) < 0)
+        {
+            fprintf(stderr, "Could not create %s%s, is the cuse module loaded and are we root?\n", prefix,
+                    strrchr(devices[i].path, '/') + 1);
+            sensors_recording_close(recording);
+            return 1;
+        }
+    }
+    ret = replay(recording, speed, loop, &signals);
+    sensors_recording_close(recording);
+    // The session threads are blocked reading /dev/cuse, the devices go away when we exit
+    return ret;
+}
@@ -9,8 +9,12 @@
 #include <linux/platform_device.h>
 #include <linux/mutex.h>
 #include <linux/io.h>
+#include <linux/timekeeping.h>
 #include "../led_lkm.h"
 
+#define CREATE_TRACE_POINTS
+#include "led_lkm_trace.h"
+
 #define MODNAME "led_test_lkm"
 #define READ_LENGTH sizeof(int)
 // NOTE: The 0x7e200000 is the base address in the bus address space
@@ -63,7 +67,8 @@ static int close_led_lkm(struct inode *inode, struct file *flip)
 }
 static long ioctl_led_lkm(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    int retval = 0;
+    int retval = 0, value = 0;
+    u64 start_ns = ktime_get_ns();
     pr_debug("In ioctl method, cmd=%d\n", _IOC_NR(cmd));
     // verify the message if for us
     if (_IOC_TYPE(cmd) != IOCTL_LED_LKM_MAGIC)
@@ -86,7 +91,8 @@ static long ioctl_led_lkm(struct file *filp, unsigned int cmd, unsigned long arg
         gpset0 |= mask;
         iowrite32(gpset0, gpriv->base_io + GPIO_SET_PIN_OFFSET);
         mutex_unlock(&gpriv->mutex_mmio);
-        pr_info("Power on\n");
+        value = 1;
+        pr_debug("Power on\n");
         break;
     case IOCTL_POWER_OFF:
         mutex_lock(&gpriv->mutex_mmio);
@@ -94,20 +100,20 @@ static long ioctl_led_lkm(struct file *filp, unsigned int cmd, unsigned long arg
         gpset0 |= mask;
         iowrite32(gpset0, gpriv->base_io + GPIO_CLEAR_PIN_OFFSET);
         mutex_unlock(&gpriv->mutex_mmio);
-        pr_info("Power off\n");
+        pr_debug("Power off\n");
         break;
     case IOCTL_POWER_READ:
         mutex_lock(&gpriv->mutex_mmio);
         gpset0 = ioread32(gpriv->base_io + GPIO_READ_PIN_OFFSET);
-        int value = gpset0 & mask;
+        value = (gpset0 & mask) ? 1 : 0;
         mutex_unlock(&gpriv->mutex_mmio);
-        retval = __put_user(value > 0 ? 1 : 0, (int __user *)arg);
-        pr_info("Read power value\n");
+        retval = __put_user(value, (int __user *)arg);
+        pr_debug("Read power value\n");
         break;
     default:
         return -ENOTTY;
     }
-
+    trace_led_lkm_ioctl(_IOC_NR(cmd), value, ktime_get_ns() - start_ns);
     return retval;
 }
 static const struct file_operations led_lkm_fops = {
@@ -0,0 +1,29 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM led_lkm
+
+#if !defined(_LED_LKM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LED_LKM_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(led_lkm_ioctl,
+            TP_PROTO(unsigned int cmd, int value, u64 duration_ns),
+            TP_ARGS(cmd, value, duration_ns),
+            TP_STRUCT__entry(
+                __field(unsigned int, cmd)
+                __field(int, value)
+                __field(u64, duration_ns)),
+            TP_fast_assign(
+                __entry->cmd = cmd;
+                __entry->value = value;
+                __entry->duration_ns = duration_ns;),
+            TP_printk("cmd=%u value=%d duration_ns=%llu",
+                      __entry->cmd, __entry->value, __entry->duration_ns));
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE led_lkm_trace
+#include <trace/define_trace.h>